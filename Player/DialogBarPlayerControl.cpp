@@ -209,15 +209,27 @@ void CDialogBarPlayerControl::OnHScroll(UINT nSBCode, UINT nPos, CScrollBar* pSc
 	{
 		if (static_cast<CWnd*>(pScrollBar) == &m_progressSlider)
 		{
-			for (int id : { SB_THUMBTRACK, SB_PAGELEFT, SB_PAGERIGHT})
-				if (nSBCode == id)
+			if (nSBCode == SB_THUMBTRACK)
+			{
+				// Dragging: preview keyframes, the exact seek comes on release
+				if (!m_seeking)
 				{
-					m_pDoc->seekByPercent(m_progressSlider.GetPos() / double(RANGE_MAX));
+					m_pDoc->beginScrub();
 					m_seeking = true;
-					break;
 				}
-			if (nSBCode == SB_ENDSCROLL)
+				m_pDoc->scrubTo(m_progressSlider.GetPos() / double(RANGE_MAX));
+			}
+			else if (nSBCode == SB_PAGELEFT || nSBCode == SB_PAGERIGHT)
+			{
+				m_pDoc->seekByPercent(m_progressSlider.GetPos() / double(RANGE_MAX));
+				m_seeking = true;
+			}
+			else if (nSBCode == SB_ENDSCROLL)
 			{
+				if (m_seeking)
+				{
+					m_pDoc->endScrub();
+				}
 				m_seeking = false;
 			}
 		}
@@ -193,6 +193,21 @@ bool CPlayerDoc::seekByPercent(double percent, int64_t totalDuration)
 	return m_frameDecoder->seekByPercent(percent, totalDuration);
 }
 
+void CPlayerDoc::beginScrub()
+{
+	m_frameDecoder->beginScrub();
+}
+
+void CPlayerDoc::scrubTo(double percent)
+{
+	m_frameDecoder->scrubTo(percent);
+}
+
+void CPlayerDoc::endScrub()
+{
+	m_frameDecoder->endScrub();
+}
+
 void CPlayerDoc::setVolume(double volume)
 {
 	m_frameDecoder->setVolume(volume);
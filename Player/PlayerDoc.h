@@ -58,6 +58,9 @@ public:
 
 	bool pauseResume();
 	bool seekByPercent(double percent, int64_t totalDuration = -1);
+	void beginScrub();
+	void scrubTo(double percent);
+	void endScrub();
 	void setVolume(double volume);
 
 	bool isPlaying() const;
@@ -65,6 +65,7 @@ BEGIN_MESSAGE_MAP(CPlayerView, CView)
 	ON_COMMAND(ID_FILE_PRINT_PREVIEW, &CView::OnFilePrintPreview)
 	ON_REGISTERED_MESSAGE(AFX_WM_DRAW2D, &CPlayerView::OnDraw2D)
 	ON_WM_CREATE()
+	ON_WM_SIZE()
 END_MESSAGE_MAP()
 
 // CPlayerView construction/destruction
@@ -210,6 +211,16 @@ int CPlayerView::OnCreate(LPCREATESTRUCT lpCreateStruct)
 }
 
 
+void CPlayerView::OnSize(UINT nType, int cx, int cy)
+{
+	CView::OnSize(nType, cx, cy);
+
+	// OnDraw2D scales into the client area anyway; have the decoder deliver that size
+	if (nType != SIZE_MINIMIZED)
+		GetDocument()->getFrameDecoder()->setTargetSize(cx, cy);
+}
+
+
 void CPlayerView::updateFrame()
 {
 	FrameRenderingData data;
@@ -254,11 +265,11 @@ void CPlayerView::updateFrame()
 		props.colorContext = nullptr;
 
 		CComPtr<ID2D1Bitmap1> yBitmap;
-		HRESULT hr = spContext->CreateBitmap({ m_sourceSize.cx, m_sourceSize.cy }, data.image[0], m_sourceSize.cx, props, &yBitmap);
+		HRESULT hr = spContext->CreateBitmap({ m_sourceSize.cx, m_sourceSize.cy }, data.image[0], data.pitch[0], props, &yBitmap);
 		CComPtr<ID2D1Bitmap1> uBitmap;
-		hr = spContext->CreateBitmap({ m_sourceSize.cx / 2, m_sourceSize.cy / 2 }, data.image[1], m_sourceSize.cx / 2, props, &uBitmap);
+		hr = spContext->CreateBitmap({ m_sourceSize.cx / 2, m_sourceSize.cy / 2 }, data.image[1], data.pitch[1], props, &uBitmap);
 		CComPtr<ID2D1Bitmap1> vBitmap;
-		hr = spContext->CreateBitmap({ m_sourceSize.cx / 2, m_sourceSize.cy / 2 }, data.image[2], m_sourceSize.cx / 2, props, &vBitmap);
+		hr = spContext->CreateBitmap({ m_sourceSize.cx / 2, m_sourceSize.cy / 2 }, data.image[2], data.pitch[2], props, &vBitmap);
 
 		m_spEffect->SetInput(0, yBitmap);
 		m_spEffect->SetInput(1, uBitmap);
@@ -270,19 +281,19 @@ void CPlayerView::updateFrame()
 			D2D1_RECT_U destRect = D2D1::RectU(0, 0, m_sourceSize.cx, m_sourceSize.cy);
 			CComPtr<ID2D1Bitmap1> yBitmap;
 			m_spEffect->GetInput(0, (ID2D1Image**)&yBitmap);
-			HRESULT hr = yBitmap->CopyFromMemory(&destRect, data.image[0], m_sourceSize.cx);
+			HRESULT hr = yBitmap->CopyFromMemory(&destRect, data.image[0], data.pitch[0]);
 		}
 		{
 			D2D1_RECT_U destRect = D2D1::RectU(0, 0, m_sourceSize.cx / 2, m_sourceSize.cy / 2);
 			CComPtr<ID2D1Bitmap1> yBitmap;
 			m_spEffect->GetInput(1, (ID2D1Image**)&yBitmap);
-			HRESULT hr = yBitmap->CopyFromMemory(&destRect, data.image[1], m_sourceSize.cx / 2);
+			HRESULT hr = yBitmap->CopyFromMemory(&destRect, data.image[1], data.pitch[1]);
 		}
 		{
 			D2D1_RECT_U destRect = D2D1::RectU(0, 0, m_sourceSize.cx / 2, m_sourceSize.cy / 2);
 			CComPtr<ID2D1Bitmap1> yBitmap;
 			m_spEffect->GetInput(2, (ID2D1Image**)&yBitmap);
-			HRESULT hr = yBitmap->CopyFromMemory(&destRect, data.image[2], m_sourceSize.cx / 2);
+			HRESULT hr = yBitmap->CopyFromMemory(&destRect, data.image[2], data.pitch[2]);
 		}
 	}
 
@@ -53,6 +53,7 @@ protected:
 	afx_msg LRESULT OnDraw2D(WPARAM wParam, LPARAM lParam);
 public:
 	afx_msg int OnCreate(LPCREATESTRUCT lpCreateStruct);
+	afx_msg void OnSize(UINT nType, int cx, int cy);
 protected:
 	void updateFrame();
 
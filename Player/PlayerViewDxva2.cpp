@@ -223,11 +223,11 @@ DXVA2_AYUVSample16 GetBackgroundColor()
 }
 
 
-void DrawText(BYTE* buffer, int width, int height, const WCHAR* text)
+void DrawText(BYTE* buffer, int width, int height, int pitch, const WCHAR* text)
 {
     using namespace Gdiplus;
 
-    Bitmap bitmap(width, height, width * 2, PixelFormat16bppRGB565, buffer);
+    Bitmap bitmap(width, height, pitch, PixelFormat16bppRGB565, buffer);
 
     Graphics graphics(&bitmap);
 
@@ -292,6 +292,7 @@ BEGIN_MESSAGE_MAP(CPlayerViewDxva2, CView)
 	ON_WM_PAINT()
 	ON_WM_CREATE()
 	ON_WM_ERASEBKGND()
+	ON_WM_SIZE()
 END_MESSAGE_MAP()
 
 
@@ -1086,6 +1087,16 @@ int CPlayerViewDxva2::OnCreate(LPCREATESTRUCT lpCreateStruct)
 	return 0;
 }
 
+
+void CPlayerViewDxva2::OnSize(UINT nType, int cx, int cy)
+{
+	CView::OnSize(nType, cx, cy);
+
+	// ProcessVideo scales into the client area anyway; have the decoder deliver that size
+	if (nType != SIZE_MINIMIZED)
+		GetDocument()->getFrameDecoder()->setTargetSize(cx, cy);
+}
+
 void CPlayerViewDxva2::updateFrame()
 {
 	FrameRenderingData data;
@@ -1094,12 +1105,6 @@ void CPlayerViewDxva2::updateFrame()
 		return;
 	}
 
-    auto subtitle = GetDocument()->getSubtitle();
-    if (!subtitle.empty())
-    {
-        DrawText(data.image[0], data.width, data.height, CA2W(subtitle.c_str(), CP_UTF8));
-    }
-
 	CSingleLock lock(&m_csSurface, TRUE);
 
 	if (data.width != m_sourceSize.cx || data.height != m_sourceSize.cy)
@@ -1120,7 +1125,14 @@ void CPlayerViewDxva2::updateFrame()
     const size_t lineSize = (size_t)min(lr.Pitch, data.width * 2);
     for (int i = 0; i < data.height; ++i)
     {
-        memcpy((BYTE*)lr.pBits + lr.Pitch * i, data.image[0] + data.width * 2 * i, lineSize);
+        memcpy((BYTE*)lr.pBits + lr.Pitch * i, data.image[0] + data.pitch[0] * i, lineSize);
+    }
+
+    // Onto the surface: the frame may be the decoder's own picture, shared with later ones
+    auto subtitle = GetDocument()->getSubtitle();
+    if (!subtitle.empty())
+    {
+        DrawText((BYTE*)lr.pBits, data.width, data.height, lr.Pitch, CA2W(subtitle.c_str(), CP_UTF8));
     }
 
 	hr = m_pMainStream->UnlockRect();
@@ -0,0 +1,217 @@
+// Micro-benchmark of the same-size conversions the views ask for.
+//
+// Converts a synthetic YUV 4:2:0 frame to YUYV 4:2:2 and to RGB24 with swscale and
+// with the YUV kernels at each instruction set the processor has, on one thread, and
+// reports the time per frame. Checks that every instruction set gives the output of
+// the C kernels, and how far that is from swscale's.
+
+#include "fpicture.h"
+#include "yuvconvert.h"
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [--size WIDTHxHEIGHT] [--frames N] [--bt709] [--full-range]\n",
+            argv0);
+}
+
+// Gradients with some noise, so neither kernels nor caches see a flat picture
+void fillFrame(AVFrame *frame)
+{
+    unsigned seed = 12345;
+    for (int plane = 0; plane < 3; ++plane)
+    {
+        const int width = plane ? (frame->width + 1) / 2 : frame->width;
+        const int height = plane ? (frame->height + 1) / 2 : frame->height;
+        for (int y = 0; y < height; ++y)
+        {
+            uint8_t *row = frame->data[plane] + ptrdiff_t(frame->linesize[plane]) * y;
+            for (int x = 0; x < width; ++x)
+            {
+                seed = seed * 1103515245 + 12345;
+                row[x] = uint8_t((x * 255 / width + y * (plane + 1)) + ((seed >> 16) & 15));
+            }
+        }
+    }
+}
+
+// Packed rows of a picture, without the padding
+std::vector<uint8_t> packedRows(const FPicture &picture, int rowBytes)
+{
+    std::vector<uint8_t> rows(size_t(rowBytes) * picture.height);
+    for (int y = 0; y < picture.height; ++y)
+    {
+        memcpy(&rows[size_t(rowBytes) * y], picture.data[0] + ptrdiff_t(picture.linesize[0]) * y,
+               rowBytes);
+    }
+    return rows;
+}
+
+int maxDifference(const std::vector<uint8_t> &a, const std::vector<uint8_t> &b)
+{
+    int difference = 0;
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        difference = std::max(difference, std::abs(a[i] - b[i]));
+    }
+    return difference;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+    int width = 1920;
+    int height = 1080;
+    int frames = 200;
+    bool bt709 = false;
+    bool fullRange = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--size") && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0)
+            {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc)
+        {
+            frames = std::max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--bt709"))
+        {
+            bt709 = true;
+        }
+        else if (!strcmp(argv[i], "--full-range"))
+        {
+            fullRange = true;
+        }
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    AVFrame *frame = av_frame_alloc();
+    frame->width = width;
+    frame->height = height;
+    frame->format = fullRange ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_YUV420P;
+    frame->colorspace = bt709 ? AVCOL_SPC_BT709 : AVCOL_SPC_BT470BG;
+    frame->color_range = fullRange ? AVCOL_RANGE_JPEG : AVCOL_RANGE_MPEG;
+    if (av_frame_get_buffer(frame, 32) < 0)
+    {
+        fprintf(stderr, "Unable to allocate a %dx%d frame\n", width, height);
+        return EXIT_FAILURE;
+    }
+    fillFrame(frame);
+
+    printf("%dx%d %s %s range, %d frames, best instruction set %s\n\n", width, height,
+           bt709 ? "BT.709" : "BT.601", fullRange ? "full" : "limited", frames,
+           yuvInstructionSetName(supportedYuvInstructionSet()));
+    printf("%-8s %-8s %10s %10s %8s %6s\n", "format", "path", "ms/frame", "Mpixel/s", "speedup",
+           "diff");
+
+    const AVPixelFormat formats[] = {AV_PIX_FMT_YUYV422, AV_PIX_FMT_RGB24};
+    const char *const formatNames[] = {"yuyv422", "rgb24"};
+    const int bytesPerPixel[] = {2, 3};
+    bool allIdentical = true;
+
+    for (int f = 0; f < 2; ++f)
+    {
+        const AVPixelFormat format = formats[f];
+        const int rowBytes = width * bytesPerPixel[f];
+        FPicture picture;
+        picture.alloc(format, width, height);
+        if (picture.data[0] == nullptr)
+        {
+            fprintf(stderr, "Unable to allocate a %s picture\n", formatNames[f]);
+            return EXIT_FAILURE;
+        }
+
+        SwsContext *scaler = sws_getContext(width, height, (AVPixelFormat)frame->format, width,
+                                            height, format, SWS_BICUBIC, nullptr, nullptr,
+                                            nullptr);
+        if (scaler == nullptr)
+        {
+            fprintf(stderr, "Unable to set up swscale for %s\n", formatNames[f]);
+            return EXIT_FAILURE;
+        }
+        // Same matrix as the kernels, so the outputs are comparable
+        const int colorspace = bt709 ? SWS_CS_ITU709 : SWS_CS_DEFAULT;
+        sws_setColorspaceDetails(scaler, sws_getCoefficients(colorspace), fullRange,
+                                 sws_getCoefficients(SWS_CS_DEFAULT), fullRange, 0, 1 << 16,
+                                 1 << 16);
+
+        auto start = Clock::now();
+        for (int i = 0; i < frames; ++i)
+        {
+            sws_scale(scaler, frame->data, frame->linesize, 0, height, picture.data,
+                      picture.linesize);
+        }
+        const double swscaleSecs = secondsSince(start) / frames;
+        const std::vector<uint8_t> swscaleOutput = packedRows(picture, rowBytes);
+        sws_freeContext(scaler);
+
+        printf("%-8s %-8s %10.3f %10.1f %8s %6s\n", formatNames[f], "swscale",
+               swscaleSecs * 1000., width * double(height) / swscaleSecs / 1e6, "1.00x", "-");
+
+        if (!canConvertYuv(frame, format))
+        {
+            printf("%-8s %-8s   (left to swscale for this range)\n", formatNames[f], "kernels");
+            continue;
+        }
+
+        std::vector<uint8_t> reference;
+        for (int isa = YUV_ISA_C; isa <= supportedYuvInstructionSet(); ++isa)
+        {
+            setYuvInstructionSet(YuvInstructionSet(isa));
+
+            start = Clock::now();
+            for (int i = 0; i < frames; ++i)
+            {
+                convertYuvRows(frame, format, 0, height, picture.data, picture.linesize);
+            }
+            const double secs = secondsSince(start) / frames;
+            const std::vector<uint8_t> output = packedRows(picture, rowBytes);
+
+            const bool identical = reference.empty() || output == reference;
+            allIdentical = allIdentical && identical;
+            if (reference.empty())
+            {
+                reference = output;
+            }
+
+            printf("%-8s %-8s %10.3f %10.1f %7.2fx %6d %s\n", formatNames[f],
+                   yuvInstructionSetName(YuvInstructionSet(isa)), secs * 1000.,
+                   width * double(height) / secs / 1e6, swscaleSecs / secs,
+                   maxDifference(output, swscaleOutput), identical ? "" : "DIFFERS FROM C");
+        }
+        setYuvInstructionSet(supportedYuvInstructionSet());
+    }
+
+    av_frame_free(&frame);
+    return allIdentical ? EXIT_SUCCESS : EXIT_FAILURE;
+}
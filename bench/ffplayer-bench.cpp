@@ -0,0 +1,392 @@
+// Headless benchmark runner for the FFmpegDecoder pipeline.
+//
+// Opens a file through GetFrameDecoder(), plays it to the end of stream with
+// a frame listener that renders nothing and a simulated audio sink, and
+// reports decoded fps, dropped frames, wall time and per-stage latencies.
+// With --seek-every it seeks through the file first, 10% further each time.
+
+#include "decoderinterface.h"
+#include "audioplayersimulated.h"
+#include "framepool.h"
+#include "tracerecorder.h"
+
+#include <boost/log/core.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+namespace
+{
+typedef std::chrono::steady_clock Clock;
+
+double secondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+void printHistogram(const char *name, const LatencyHistogramData &data)
+{
+    printf("%-24s %10llu %10.3f %10.3f %10.3f %10.3f\n", name, (unsigned long long)data.count,
+           data.mean() * 1000., data.percentile(0.5) * 1000., data.percentile(0.99) * 1000.,
+           data.maxSecs * 1000.);
+}
+
+void printQueueLevel(const char *name, const PacketQueueLevel &level)
+{
+    printf("%-24s %10d %10.1f %10.3f %10.3f %10.1f\n", name, level.packets, level.bytes / 1024.,
+           level.secs, level.targetSecs, level.byteLimit / 1024.);
+}
+
+class NullFrameListener : public IFrameListener
+{
+   public:
+    void setDecoder(IFrameDecoder *decoder) { m_decoder = decoder; }
+
+    void updateFrame() override {}
+    void drawFrame() override
+    {
+        FrameRenderingData data;
+        if (m_decoder->getFrameRenderingData(&data))
+        {
+            m_width = data.width;
+            m_height = data.height;
+        }
+        m_decoder->finishedDisplayingFrame();
+    }
+
+    // Of the last picture presented
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+   private:
+    IFrameDecoder *m_decoder = nullptr;
+    int m_width = 0;
+    int m_height = 0;
+};
+
+class EndOfStreamListener : public FrameDecoderListener
+{
+   public:
+    void onEndOfStream() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_finished = true;
+        }
+        m_cv.notify_all();
+    }
+
+    bool wait(double timeoutSecs)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (timeoutSecs <= 0)
+        {
+            m_cv.wait(lock, [this] { return m_finished; });
+            return true;
+        }
+        return m_cv.wait_for(lock, std::chrono::duration<double>(timeoutSecs),
+                             [this] { return m_finished; });
+    }
+
+   private:
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    bool m_finished = false;
+};
+
+void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [--format yuv420p|yuyv422|rgb24] [--timeout SECONDS]\n"
+            "          [--audio-buffer-ms MS] [--audio-jitter-ms MS] [--audio-drift-ppm PPM]\n"
+            "          [--read-ahead-mb MB] [--seek-every SECONDS] [--exact-seek]\n"
+            "          [--thumbnails-mb MB] [--decode-threads N] [--threading auto|frame|slice]\n"
+            "          [--frame-queue N] [--huge-pages] [--fixed-quality] [--target-size WxH]\n"
+            "          [--lowres] [--trace TRACE.json] FILE\n",
+            argv0);
+}
+
+}  // namespace
+
+int main(int argc, char *argv[])
+{
+    IFrameDecoder::FrameFormat format = IFrameDecoder::PIX_FMT_YUV420P;
+    double timeoutSecs = 0;
+    AudioPlayerSimulated::Settings audioSettings;
+    const char *file = nullptr;
+    const char *traceFile = nullptr;
+    int64_t readAheadSize = 0;
+    double seekEverySecs = 0;
+    bool exactSeek = false;
+    int64_t thumbnailCacheSize = 0;
+    int decodingThreads = 0;
+    IFrameDecoder::ThreadingMode threadingMode = IFrameDecoder::THREADING_AUTO;
+    int frameQueueDepth = 0;
+    bool hugePages = false;
+    bool adaptiveQuality = true;
+    int targetWidth = 0;
+    int targetHeight = 0;
+    bool lowresDecoding = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (!strcmp(argv[i], "--format") && i + 1 < argc)
+        {
+            const char *name = argv[++i];
+            if (!strcmp(name, "yuv420p"))
+                format = IFrameDecoder::PIX_FMT_YUV420P;
+            else if (!strcmp(name, "yuyv422"))
+                format = IFrameDecoder::PIX_FMT_YUYV422;
+            else if (!strcmp(name, "rgb24"))
+                format = IFrameDecoder::PIX_FMT_RGB24;
+            else
+            {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strcmp(argv[i], "--timeout") && i + 1 < argc)
+        {
+            timeoutSecs = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--audio-buffer-ms") && i + 1 < argc)
+        {
+            audioSettings.bufferSecs = atof(argv[++i]) / 1000.;
+        }
+        else if (!strcmp(argv[i], "--audio-jitter-ms") && i + 1 < argc)
+        {
+            audioSettings.jitterSecs = atof(argv[++i]) / 1000.;
+        }
+        else if (!strcmp(argv[i], "--audio-drift-ppm") && i + 1 < argc)
+        {
+            audioSettings.driftPpm = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--read-ahead-mb") && i + 1 < argc)
+        {
+            readAheadSize = int64_t(atof(argv[++i]) * 1024 * 1024);
+        }
+        else if (!strcmp(argv[i], "--seek-every") && i + 1 < argc)
+        {
+            seekEverySecs = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--exact-seek"))
+        {
+            exactSeek = true;
+        }
+        else if (!strcmp(argv[i], "--thumbnails-mb") && i + 1 < argc)
+        {
+            thumbnailCacheSize = int64_t(atof(argv[++i]) * 1024 * 1024);
+        }
+        else if (!strcmp(argv[i], "--decode-threads") && i + 1 < argc)
+        {
+            decodingThreads = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--threading") && i + 1 < argc)
+        {
+            const char *name = argv[++i];
+            if (!strcmp(name, "auto"))
+                threadingMode = IFrameDecoder::THREADING_AUTO;
+            else if (!strcmp(name, "frame"))
+                threadingMode = IFrameDecoder::THREADING_FRAME;
+            else if (!strcmp(name, "slice"))
+                threadingMode = IFrameDecoder::THREADING_SLICE;
+            else
+            {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strcmp(argv[i], "--frame-queue") && i + 1 < argc)
+        {
+            frameQueueDepth = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--huge-pages"))
+        {
+            hugePages = true;
+        }
+        else if (!strcmp(argv[i], "--fixed-quality"))
+        {
+            adaptiveQuality = false;
+        }
+        else if (!strcmp(argv[i], "--target-size") && i + 1 < argc)
+        {
+            if (sscanf(argv[++i], "%dx%d", &targetWidth, &targetHeight) != 2)
+            {
+                usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (!strcmp(argv[i], "--lowres"))
+        {
+            lowresDecoding = true;
+        }
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+        {
+            traceFile = argv[++i];
+        }
+        else if (argv[i][0] != '-' && file == nullptr)
+        {
+            file = argv[i];
+        }
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (file == nullptr)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    boost::log::core::get()->set_logging_enabled(false);
+
+    // The listeners must outlive the decoder, which notifies them on destruction.
+    NullFrameListener frameListener;
+    EndOfStreamListener decoderListener;
+
+    auto audioPlayer = new AudioPlayerSimulated(audioSettings);
+    auto decoder = GetFrameDecoder(std::unique_ptr<IAudioPlayer>(audioPlayer));
+    frameListener.setDecoder(decoder.get());
+    decoder->setFrameListener(&frameListener);
+    decoder->setDecoderListener(&decoderListener);
+    decoder->SetFrameFormat(format);
+    decoder->setReadAheadSize(readAheadSize);
+    decoder->setExactSeek(exactSeek);
+    decoder->setThumbnailCache(thumbnailCacheSize, false);
+    decoder->setDecodingThreads(decodingThreads, threadingMode);
+    decoder->setFrameQueueDepth(frameQueueDepth);
+    decoder->setAdaptiveQuality(adaptiveQuality);
+    decoder->setTargetSize(targetWidth, targetHeight);
+    decoder->setLowresDecoding(lowresDecoding);
+    FramePool::instance().setHugePages(hugePages);
+
+    if (traceFile)
+    {
+        TraceRecorder::instance().start();
+    }
+
+    const auto start = Clock::now();
+
+    if (!decoder->openFile(file))
+    {
+        fprintf(stderr, "Unable to open %s\n", file);
+        return EXIT_FAILURE;
+    }
+
+    const double openTime = secondsSince(start);
+
+    decoder->play();
+
+    enum { SEEK_STEPS = 10 };
+    bool finished = false;
+    if (seekEverySecs > 0)
+    {
+        for (int step = 1; step < SEEK_STEPS && !finished; ++step)
+        {
+            finished = decoderListener.wait(seekEverySecs);
+            if (!finished)
+            {
+                decoder->seekByPercent(step / double(SEEK_STEPS));
+            }
+        }
+    }
+    if (!finished)
+    {
+        finished = decoderListener.wait(timeoutSecs);
+    }
+    const double wallTime = secondsSince(start);
+
+    // Hover previews available along the seek bar, probed at every percent
+    enum { THUMBNAIL_PROBES = 101 };
+    std::set<long long> thumbnailPositions;
+    for (int i = 0; i < THUMBNAIL_PROBES; ++i)
+    {
+        if (auto thumbnail = decoder->getThumbnail(i / double(THUMBNAIL_PROBES - 1)))
+        {
+            thumbnailPositions.insert(thumbnail->position);
+        }
+    }
+
+    decoder->close();
+
+    if (traceFile)
+    {
+        TraceRecorder::instance().stop();
+        if (!TraceRecorder::instance().save(traceFile))
+        {
+            fprintf(stderr, "Unable to write %s\n", traceFile);
+        }
+    }
+
+    const DecoderStatistics stats = decoder->getStatistics();
+    const double playTime = wallTime - openTime;
+
+    printf("file:             %s\n", file);
+    printf("finished:         %s\n", finished ? "end of stream" : "timeout");
+    printf("open time:        %.3f s\n", openTime);
+    printf("wall time:        %.3f s\n", wallTime);
+    printf("decode threads:   %d %s, latency %.1f ms\n", stats.decodingThreads,
+           stats.frameThreading ? "frame" : "slice", stats.decoderLatencySecs * 1000.);
+    printf("output size:      %dx%d, decoded at 1/%d resolution\n", frameListener.width(),
+           frameListener.height(), 1 << stats.lowres);
+    printf("decoded frames:   %llu\n", (unsigned long long)stats.decodedFrames);
+    printf("presented frames: %llu\n", (unsigned long long)stats.presentedFrames);
+    printf("passthrough:      %llu\n", (unsigned long long)stats.passthroughFrames);
+    printf("hard skip frames: %llu\n", (unsigned long long)stats.hardSkippedFrames);
+    printf("framedrop frames: %llu\n", (unsigned long long)stats.droppedFrames);
+    printf("frame queue:      %d deep, %d at most\n", stats.frameQueueDepth,
+           stats.maxFrameQueueDepth);
+    const FramePool::Statistics pool = FramePool::instance().getStatistics();
+    printf("frame pool:       %llu hits, %llu misses, %.1f MB idle\n",
+           (unsigned long long)pool.hits, (unsigned long long)pool.misses,
+           pool.idleBytes / (1024. * 1024.));
+    printf("degradations:     %llu loop filter, %llu nonref, %llu keyframes, %llu scaling;"
+           " level %d at the end\n",
+           (unsigned long long)stats.degradations[DEGRADATION_SKIP_LOOP_FILTER],
+           (unsigned long long)stats.degradations[DEGRADATION_SKIP_NONREF],
+           (unsigned long long)stats.degradations[DEGRADATION_KEYFRAMES_ONLY],
+           (unsigned long long)stats.degradations[DEGRADATION_FAST_SCALING],
+           stats.degradationLevel);
+    printf("starvations:      video %llu, audio %llu\n",
+           (unsigned long long)stats.videoStarvations, (unsigned long long)stats.audioStarvations);
+    printf("overfilled:       %llu packets, %llu parked\n",
+           (unsigned long long)stats.overfilledPackets, (unsigned long long)stats.parkedPackets);
+    printf("audio played:     %.3f s\n", audioPlayer->playedSecs());
+    printf("audio underruns:  %lld\n", audioPlayer->underruns());
+    printf("audio ring:       %.0f of %.0f ms filled at the end, %llu underruns\n",
+           stats.audioRingSecs * 1000., stats.audioRingCapacitySecs * 1000.,
+           (unsigned long long)stats.audioRingUnderruns);
+    if (thumbnailCacheSize > 0)
+    {
+        printf("thumbnails:       %u distinct of %d probes\n",
+               (unsigned)thumbnailPositions.size(), (int)THUMBNAIL_PROBES);
+    }
+    printf("decoded fps:      %.2f\n", (playTime > 0) ? stats.decodedFrames / playTime : 0.);
+
+    printf("\n%-24s %10s %10s %10s %10s %10s\n", "stage (ms)", "count", "mean", "p50", "p99",
+           "max");
+    printHistogram("video packet wait", stats.videoPacketWait);
+    printHistogram("audio packet wait", stats.audioPacketWait);
+    printHistogram("video decode", stats.videoDecode);
+    printHistogram("image conversion", stats.imageConversion);
+    printHistogram("frame queue wait", stats.videoFrameQueueWait);
+    printHistogram("present lateness", stats.presentLateness);
+    printHistogram("seek latency", stats.seekLatency);
+
+    printf("\n%-24s %10s %10s %10s %10s %10s\n", "packet queue", "packets", "KB", "secs",
+           "target", "limit KB");
+    printQueueLevel("video", stats.videoQueue);
+    printQueueLevel("audio", stats.audioQueue);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,87 @@
+#include "audiooutputrunnable.h"
+#include "makeguard.h"
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+namespace
+{
+
+// Audio handed to the device at a time: a request waits for no more than this
+const double OUTPUT_CHUNK_SECS = 0.01;
+
+}  // namespace
+
+void AudioOutputRunnable::operator()()
+{
+    CHANNEL_LOG(ffmpeg_threads) << "Audio output thread started";
+    TraceRecorder::instance().setThreadName("audio output");
+
+    FFmpegDecoder* ff = m_ffmpeg;
+    PcmRing& ring = ff->m_audioRing;
+    IAudioPlayer* player = ff->m_audioPlayer.get();
+
+    player->InitializeThread();
+    auto deinitializeThread =
+        MakeGuard(player, std::mem_fn(&IAudioPlayer::DeinitializeThread));
+
+    const int frameBytes = ring.frameBytes();
+    const int bytesPerSecond = ff->m_audioSettings.frequency * frameBytes;
+    std::vector<uint8_t> chunk(
+        std::max(frameBytes, int(bytesPerSecond * OUTPUT_CHUNK_SECS) / frameBytes * frameBytes));
+
+    bool paused = false;
+    bool playing = false;  // fed the device since the last reset
+    bool dry = false;      // and found the ring empty since
+    for (;;)
+    {
+        if (ff->m_audioOutputPaused != paused)
+        {
+            paused = !paused;
+            if (paused)
+            {
+                player->WaveOutPause();
+            }
+            else
+            {
+                player->WaveOutRestart();
+            }
+        }
+        if (ff->m_audioOutputReset.exchange(false))
+        {
+            player->WaveOutReset();
+            ring.skipDiscarded();
+            playing = false;
+            dry = false;
+        }
+
+        const int64_t size = paused ? 0 : ring.read(chunk.data(), int64_t(chunk.size()));
+        if (size == 0)
+        {
+            // Running dry at the end of the stream or for a pause isn't an underrun; it
+            // only counts once playing goes on, see below
+            dry = dry || (playing && !paused);
+            ring.waitConsumer([ff, &ring, paused]() {
+                return ff->m_audioOutputPaused != paused || ff->m_audioOutputReset ||
+                       (!paused && ring.filledBytes() > 0);
+            });
+            continue;
+        }
+
+        if (dry)
+        {
+            // Decoding fell behind the device, which had only its own buffer left to play
+            ++ff->m_statistics.audioRingUnderruns;
+            dry = false;
+        }
+        playing = true;
+
+        TRACE_SPAN("write audio");
+        if (!player->WriteAudio(chunk.data(), size) && bytesPerSecond > 0)
+        {
+            // No device to report the time played, so keep the audio clock going here
+            ff->AppendFrameClock(double(size) / bytesPerSecond);
+        }
+    }
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "ffmpegdecoder.h"
+
+// Feeds the audio device from m_audioRing, filled by the audio decoder thread. Only this
+// thread waits on the device; it also carries out the pause, restart and reset requests
+// of the audio thread, between writes, so that it never waits on a stopped device.
+class AudioOutputRunnable
+{
+	FFmpegDecoder* m_ffmpeg;
+
+public:
+	explicit AudioOutputRunnable(FFmpegDecoder* parent)
+		: m_ffmpeg(parent)
+	{}
+	void operator()();
+};
@@ -1,35 +1,72 @@
 #include "audioparserunnable.h"
-#include "makeguard.h"
 
 #include <boost/log/trivial.hpp>
 
-#include <functional>
 #include <memory>
 
-bool AudioParseRunnable::getAudioPacket(AVPacket* packet)
+bool AudioParseRunnable::getAudioPacket(AVPacket* packet, unsigned* generation)
 {
+    const double waitStart = GetHiResTime();
+
+    FQueue& queue = m_ffmpeg->m_audioPacketsQueue;
+    queue.waitConsumer([this, &queue]()
+                       {
+                           return !queue.empty() || m_ffmpeg->m_scrubbing ||
+                                  (m_ffmpeg->m_isPaused && !m_ffmpeg->m_isAudioSeekingWhilePaused);
+                       });
+    if (m_ffmpeg->m_scrubbing || !queue.pop(packet, generation))
     {
-        boost::unique_lock<boost::mutex> locker(m_ffmpeg->m_packetsQueueMutex);
+        return false;  // paused, scrubbing, or only stale packets were left
+    }
+
+    const double waitEnd = GetHiResTime();
+    m_ffmpeg->m_statistics.audioPacketWait.add(waitEnd - waitStart);
+    TraceRecorder::instance().addSpan("audio packet wait", waitStart, waitEnd);
+
+    return true;
+}
+
+void AudioParseRunnable::pauseOutput(bool pause)
+{
+    m_ffmpeg->m_audioOutputPaused = pause;
+    m_ffmpeg->m_audioRing.notifyAll();
+}
 
-        while (m_ffmpeg->m_audioPacketsQueue.size() == 0)
+void AudioParseRunnable::resetOutput()
+{
+    m_ffmpeg->m_audioRing.discard();
+    m_ffmpeg->m_audioOutputReset = true;
+    m_ffmpeg->m_audioRing.notifyAll();
+}
+
+bool AudioParseRunnable::writeAudio(const uint8_t* data, int64_t size)
+{
+    PcmRing& ring = m_ffmpeg->m_audioRing;
+    for (;;)
+    {
+        const int64_t written = ring.write(data, size);
+        data += written;
+        size -= written;
+        if (size <= 0)
         {
-            if (m_ffmpeg->m_isPaused && !m_ffmpeg->m_isAudioSeekingWhilePaused)
-            {
-                return false;
-            }
-            m_ffmpeg->m_packetsQueueCV.wait(locker);
+            return true;
+        }
+        if (boost::this_thread::interruption_requested())
+        {
+            return false;
         }
 
-        *packet = m_ffmpeg->m_audioPacketsQueue.dequeue();
+        // Full: a good while of audio is waiting, so the output thread frees room
+        // long before the device could run dry
+        TRACE_SPAN("audio ring wait");
+        ring.waitProducer([&ring]() { return ring.writable(); });
     }
-    m_ffmpeg->m_packetsQueueCV.notify_all();
-
-    return true;
 }
 
 void AudioParseRunnable::operator()()
 {
     CHANNEL_LOG(ffmpeg_threads) << "Audio thread started";
+    TraceRecorder::instance().setThreadName("audio");
     AVPacket packet;
 
     bool initialized = false;
@@ -38,18 +75,41 @@ void AudioParseRunnable::operator()()
 
     bool aPauseDisabled = false;
 
-    m_ffmpeg->m_audioPlayer->InitializeThread();
-    auto deinitializeThread = MakeGuard(
-        m_ffmpeg->m_audioPlayer.get(),
-        std::mem_fn(&IAudioPlayer::DeinitializeThread));
+    unsigned generation = m_ffmpeg->m_audioPacketsQueue.generation();
+    int64_t seekTarget = AV_NOPTS_VALUE;  // exact seek: audio ending before it gets dropped
 
     std::vector<uint8_t> resampleBuffer;
 
     for (;;)
     {
+        if (m_ffmpeg->m_scrubbing)
+        {
+            // Muted while scrubbing; endScrub() seeks, so nothing played so far is of use
+            pauseOutput(true);
+            resetOutput();
+            aPauseDisabled = true;
+
+            if (boost::this_thread::interruption_requested())
+            {
+                if (handlePacketPostponed)
+                {
+                    av_free_packet(&packet);
+                }
+                CHANNEL_LOG(ffmpeg_threads) << "Audio thread broken";
+                return;
+            }
+
+            boost::unique_lock<boost::mutex> locker(m_ffmpeg->m_isPausedMutex);
+            while (m_ffmpeg->m_scrubbing)
+            {
+                m_ffmpeg->m_isPausedCV.wait(locker);
+            }
+            continue;
+        }
+
         if (m_ffmpeg->m_isPaused && !m_ffmpeg->m_isAudioSeekingWhilePaused)
         {
-            m_ffmpeg->m_audioPlayer->WaveOutPause();
+            pauseOutput(true);
             aPauseDisabled = true;
 
             if (boost::this_thread::interruption_requested())
@@ -63,7 +123,7 @@ void AudioParseRunnable::operator()()
             }
 
             boost::unique_lock<boost::mutex> locker(m_ffmpeg->m_isPausedMutex);
-            while (m_ffmpeg->m_isPaused)
+            while (m_ffmpeg->m_isPaused && !m_ffmpeg->m_isAudioSeekingWhilePaused)
             {
                 m_ffmpeg->m_isPausedCV.wait(locker);
             }
@@ -72,14 +132,15 @@ void AudioParseRunnable::operator()()
 
         if (aPauseDisabled && !m_ffmpeg->m_isAudioSeekingWhilePaused)
         {
-            m_ffmpeg->m_audioPlayer->WaveOutRestart();
+            pauseOutput(false);
             aPauseDisabled = false;
         }
 
         if (handlePacketPostponed)
         {
             handlePacketPostponed = false;
-            if (m_ffmpeg->m_isAudioSeekingWhilePaused)
+            if (m_ffmpeg->m_isAudioSeekingWhilePaused ||
+                m_ffmpeg->m_audioPacketsQueue.generation() != generation)
             {
                 av_free_packet(&packet);
             }
@@ -92,11 +153,34 @@ void AudioParseRunnable::operator()()
 
         for (;;)
         {
-            if (!getAudioPacket(&packet))
+            unsigned packetGeneration;
+            if (!getAudioPacket(&packet, &packetGeneration))
             {
                 break;
             }
 
+            if (packetGeneration != generation)
+            {
+                // First packet after a seek: drop what the ring and the device still hold
+                generation = packetGeneration;
+                avcodec_flush_buffers(m_ffmpeg->m_audioCodecContext);
+                resetOutput();
+                initialized = false;
+                seekTarget = m_ffmpeg->m_seekTarget;
+            }
+
+            if (seekTarget != AV_NOPTS_VALUE && packet.pts != AV_NOPTS_VALUE)
+            {
+                const double packetEnd = av_q2d(m_ffmpeg->m_audioStream->time_base) *
+                                         (packet.pts + packet.duration);
+                if (packetEnd <= av_q2d(m_ffmpeg->m_videoStream->time_base) * seekTarget)
+                {
+                    av_free_packet(&packet);
+                    continue;
+                }
+                seekTarget = AV_NOPTS_VALUE;
+            }
+
             if (!initialized)
             {
                 if (packet.pts != AV_NOPTS_VALUE)
@@ -133,7 +217,8 @@ void AudioParseRunnable::operator()()
                 break;
             }
 
-            if (m_ffmpeg->m_isPaused && !m_ffmpeg->m_isAudioSeekingWhilePaused)
+            if ((m_ffmpeg->m_isPaused && !m_ffmpeg->m_isAudioSeekingWhilePaused) ||
+                m_ffmpeg->m_scrubbing)
             {
                 break;
             }
@@ -158,8 +243,12 @@ bool AudioParseRunnable::handlePacket(AVPacket& packet, std::vector<uint8_t>& re
     {
         int audioDecoded(0);
 
-        const int length = avcodec_decode_audio4(m_ffmpeg->m_audioCodecContext,
-                                                 m_ffmpeg->m_audioFrame, &audioDecoded, &packet);
+        int length;
+        {
+            TRACE_SPAN("decode audio");
+            length = avcodec_decode_audio4(m_ffmpeg->m_audioCodecContext, m_ffmpeg->m_audioFrame,
+                                           &audioDecoded, &packet);
+        }
         if (length < 0)
         {
             // Broken packet
@@ -279,18 +368,9 @@ bool AudioParseRunnable::handlePacket(AVPacket& packet, std::vector<uint8_t>& re
                 return false;
             }
 
-            if (!m_ffmpeg->m_audioPlayer->WriteAudio(write_data, write_size) &&
-                m_ffmpeg->m_audioFrame->sample_rate)
+            if (!writeAudio(write_data, write_size))
             {
-                const double frame_clock =
-                    (double)original_buffer_size / (av_frame_get_channels(m_ffmpeg->m_audioFrame) *
-                                                    m_ffmpeg->m_audioFrame->sample_rate *
-                                                    av_get_bytes_per_sample(audioFrameFormat));
-
-                for (double v = m_ffmpeg->m_audioPTS;
-                     !m_ffmpeg->m_audioPTS.compare_exchange_weak(v, v + frame_clock);)
-                {
-                }
+                return false;
             }
         }
     }
@@ -9,9 +9,15 @@ class AudioParseRunnable
 {
     FFmpegDecoder* m_ffmpeg;
 
-    bool getAudioPacket(AVPacket* packet);
+    bool getAudioPacket(AVPacket* packet, unsigned* generation);
     bool handlePacket(AVPacket& packet, std::vector<uint8_t>& resampleBuffer);
 
+    // Requests to the output thread, which alone drives the device
+    void pauseOutput(bool pause);
+    void resetOutput();
+    // Queues samples for it; false if this thread is to stop
+    bool writeAudio(const uint8_t* data, int64_t size);
+
 public:
 	explicit AudioParseRunnable(FFmpegDecoder* parent)
 		: m_ffmpeg(parent)
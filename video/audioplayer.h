@@ -12,6 +12,8 @@ struct IAudioPlayer
 	virtual ~IAudioPlayer() {}
 	virtual void SetCallback(IAudioPlayerCallback* callback) = 0;
 
+    // Everything below but SetVolume/GetVolume is called on the decoder's audio output
+    // thread, or with it stopped, see AudioOutputRunnable
     virtual void InitializeThread() = 0;
     virtual void DeinitializeThread() = 0;
 
@@ -0,0 +1,211 @@
+#include "audioplayersimulated.h"
+
+#include <algorithm>
+#include <random>
+
+namespace
+{
+template <typename Duration>
+Duration toDuration(double secs)
+{
+    return boost::chrono::duration_cast<Duration>(boost::chrono::duration<double>(secs));
+}
+
+}  // namespace
+
+AudioPlayerSimulated::AudioPlayerSimulated(const Settings& settings)
+    : m_settings(settings),
+      m_callback(nullptr),
+      m_volume(1.),
+      m_bytesPerSecond(0),
+      m_blockAlign(0),
+      m_bufferBytes(0),
+      m_filledBytes(0),
+      m_paused(false),
+      m_closing(true),
+      m_starved(true),
+      m_underruns(0),
+      m_playedBytes(0)
+{
+}
+
+AudioPlayerSimulated::~AudioPlayerSimulated() { Close(); }
+
+bool AudioPlayerSimulated::Open(int bytesPerSample, int samplesPerSec, int channels)
+{
+    Close();
+
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        m_blockAlign = bytesPerSample * channels;
+        m_bytesPerSecond = m_blockAlign * samplesPerSec;
+        m_bufferBytes = std::max<int64_t>(
+            m_blockAlign,
+            int64_t(m_settings.bufferSecs * m_bytesPerSecond) / m_blockAlign * m_blockAlign);
+        m_filledBytes = 0;
+        m_paused = false;
+        m_closing = false;
+        m_starved = true;
+        m_underruns = 0;
+        m_playedBytes = 0;
+    }
+
+    m_deviceThread.reset(new boost::thread(&AudioPlayerSimulated::deviceThread, this));
+    return true;
+}
+
+void AudioPlayerSimulated::Close()
+{
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        m_closing = true;
+    }
+    m_cv.notify_all();
+
+    if (m_deviceThread)
+    {
+        m_deviceThread->join();
+        m_deviceThread.reset();
+    }
+}
+
+void AudioPlayerSimulated::Reset()
+{
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        m_filledBytes = 0;
+        m_paused = false;
+        m_starved = true;
+    }
+    m_cv.notify_all();
+}
+
+void AudioPlayerSimulated::WaveOutReset()
+{
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        m_filledBytes = 0;
+        m_starved = true;
+    }
+    m_cv.notify_all();
+}
+
+void AudioPlayerSimulated::WaveOutPause()
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    m_paused = true;
+}
+
+void AudioPlayerSimulated::WaveOutRestart()
+{
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        m_paused = false;
+    }
+    m_cv.notify_all();
+}
+
+bool AudioPlayerSimulated::WriteAudio(uint8_t* /*write_data*/, int64_t write_size)
+{
+    boost::unique_lock<boost::mutex> locker(m_mutex);
+    if (m_closing)
+    {
+        return false;
+    }
+
+    // Blocks like a device with no free buffers would; the wait is an interruption point.
+    while (write_size > 0)
+    {
+        m_cv.wait(locker, [this]() { return m_closing || m_filledBytes < m_bufferBytes; });
+        if (m_closing)
+        {
+            return false;
+        }
+
+        const int64_t chunk = std::min(write_size, m_bufferBytes - m_filledBytes);
+        m_filledBytes += chunk;
+        write_size -= chunk;
+    }
+
+    return true;
+}
+
+long long AudioPlayerSimulated::underruns() const
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    return m_underruns;
+}
+
+double AudioPlayerSimulated::playedSecs() const
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    return (m_bytesPerSecond > 0) ? double(m_playedBytes) / m_bytesPerSecond : 0.;
+}
+
+void AudioPlayerSimulated::deviceThread()
+{
+    std::mt19937 generator(m_settings.seed);
+    std::uniform_real_distribution<double> jitter(-m_settings.jitterSecs, m_settings.jitterSecs);
+
+    boost::unique_lock<boost::mutex> locker(m_mutex);
+
+    const int bytesPerSecond = m_bytesPerSecond;
+    const int64_t periodBytes = std::max<int64_t>(
+        m_blockAlign,
+        int64_t(m_settings.periodSecs * bytesPerSecond) / m_blockAlign * m_blockAlign);
+
+    // A device clock running fast drains its nominal period in less wall time.
+    const auto wallPeriod = toDuration<Clock::duration>(
+        double(periodBytes) / bytesPerSecond / (1. + m_settings.driftPpm * 1e-6));
+
+    Clock::time_point schedule = Clock::now();
+
+    for (;;)
+    {
+        schedule += wallPeriod;
+        const Clock::time_point wakeTime =
+            schedule + toDuration<Clock::duration>(
+                           (m_settings.jitterSecs > 0) ? jitter(generator) : 0.);
+
+        while (!m_closing && m_cv.wait_until(locker, wakeTime) != boost::cv_status::timeout)
+        {
+        }
+
+        if (m_closing)
+        {
+            return;
+        }
+
+        if (m_paused)
+        {
+            m_cv.wait(locker, [this]() { return m_closing || !m_paused; });
+            schedule = Clock::now();
+            continue;
+        }
+
+        if (m_filledBytes < periodBytes)
+        {
+            if (!m_starved)
+            {
+                ++m_underruns;
+                m_starved = true;
+            }
+        }
+        else
+        {
+            m_starved = false;
+        }
+
+        const int64_t consumed = std::min(m_filledBytes, periodBytes);
+        m_filledBytes -= consumed;
+        m_playedBytes += consumed;
+
+        locker.unlock();
+        m_cv.notify_all();
+        if (consumed > 0 && m_callback)
+        {
+            m_callback->AppendFrameClock(double(consumed) / bytesPerSecond);
+        }
+        locker.lock();
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "audioplayer.h"
+
+#include <boost/chrono.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <memory>
+
+// Portable IAudioPlayer that discards PCM but consumes it on a real-time
+// schedule the way a sound card does: a device thread drains the buffer once
+// per period and reports every drained chunk through AppendFrameClock.
+// Buffer size, callback jitter and device clock drift are configurable, so
+// A/V sync can be exercised without audio hardware.
+class AudioPlayerSimulated : public IAudioPlayer
+{
+   public:
+    struct Settings
+    {
+        double bufferSecs;  // device buffer size, i.e. output latency
+        double periodSecs;  // nominal interval between device callbacks
+        double jitterSecs;  // callbacks fire uniformly within +/- jitterSecs of schedule
+        double driftPpm;    // device clock rate error, > 0 means it runs fast
+        unsigned seed;
+
+        Settings() : bufferSecs(0.1), periodSecs(0.01), jitterSecs(0), driftPpm(0), seed(0) {}
+    };
+
+    explicit AudioPlayerSimulated(const Settings& settings = Settings());
+    ~AudioPlayerSimulated();
+
+    AudioPlayerSimulated(const AudioPlayerSimulated&) = delete;
+    AudioPlayerSimulated& operator=(const AudioPlayerSimulated&) = delete;
+
+    void SetCallback(IAudioPlayerCallback* callback) override { m_callback = callback; }
+
+    void InitializeThread() override {}
+    void DeinitializeThread() override {}
+
+    void WaveOutReset() override;
+
+    void Close() override;
+    bool Open(int bytesPerSample, int samplesPerSec, int channels) override;
+    void Reset() override;
+
+    void SetVolume(double volume) override { m_volume = volume; }
+    double GetVolume() const override { return m_volume; }
+
+    void WaveOutPause() override;
+    void WaveOutRestart() override;
+
+    bool WriteAudio(uint8_t* write_data, int64_t write_size) override;
+
+    // Times the device ran dry while playing.
+    long long underruns() const;
+    // Seconds of audio reported through AppendFrameClock since Open.
+    double playedSecs() const;
+
+   private:
+    typedef boost::chrono::steady_clock Clock;
+
+    void deviceThread();
+
+    const Settings m_settings;
+
+    IAudioPlayerCallback* m_callback;
+    double m_volume;
+
+    mutable boost::mutex m_mutex;
+    boost::condition_variable m_cv;
+
+    int m_bytesPerSecond;
+    int m_blockAlign;
+    int64_t m_bufferBytes;
+    int64_t m_filledBytes;
+    bool m_paused;
+    bool m_closing;
+    bool m_starved;
+
+    long long m_underruns;
+    int64_t m_playedBytes;
+
+    std::unique_ptr<boost::thread> m_deviceThread;
+};
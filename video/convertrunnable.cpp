@@ -0,0 +1,109 @@
+#include "convertrunnable.h"
+#include "frameconverter.h"
+#include "makeguard.h"
+
+#include <boost/log/trivial.hpp>
+
+#include <algorithm>
+#include <utility>
+
+namespace
+{
+
+// Conversion bands in flight; the decoder threads keep the remaining cores
+enum { MAX_CONVERSION_THREADS = 4 };
+
+int conversionThreads()
+{
+    return std::min<int>(std::max(1u, boost::thread::hardware_concurrency() / 2),
+                         MAX_CONVERSION_THREADS);
+}
+
+}  // namespace
+
+void ConvertRunnable::operator()()
+{
+    CHANNEL_LOG(ffmpeg_threads) << "Conversion thread started";
+    TraceRecorder::instance().setThreadName("convert");
+
+    FFmpegDecoder* ff = m_ffmpeg;
+    VQueue& frames = ff->m_videoFramesQueue;
+    FrameConverter converter(conversionThreads());
+
+    for (;;)
+    {
+        FFmpegDecoder::ConversionJob job;
+        {
+            boost::unique_lock<boost::mutex> locker(ff->m_videoFramesMutex);
+            ff->m_videoFramesCV.wait(locker, [ff]() { return !ff->m_conversionJobs.empty(); });
+            job = ff->m_conversionJobs.front();
+            ff->m_conversionJobs.pop_front();
+        }
+        auto frameGuard = MakeGuard(&job.frame, av_frame_free);
+
+        // The slot was reserved by the decoder thread, so the display isn't reading it
+        VideoFrame* current_frame = &frames.m_frames[frames.m_write_counter];
+
+        // Frames predating a seek aren't worth converting
+        bool converted = false;
+        if (ff->m_videoPacketsQueue.generation() == job.generation)
+        {
+            int width, height;
+            ff->getOutputSize(job.frame->width, job.frame->height, &width, &height);
+            if (job.frame->format == ff->m_pixelFormat && width == job.frame->width &&
+                height == job.frame->height)
+            {
+                // Already in the output format: show the decoder's picture, not a copy of it
+                current_frame->m_image.free();
+                av_frame_free(&current_frame->m_source);
+                std::swap(current_frame->m_source, job.frame);
+                converted = true;
+                ++ff->m_statistics.passthroughFrames;
+            }
+            else
+            {
+                av_frame_free(&current_frame->m_source);
+                {
+                    boost::lock_guard<boost::mutex> locker(ff->m_videoFramesMutex);
+                    frames.reuseSpare(*current_frame);
+                }
+
+                converter.setFastScaling(ff->m_degradationLevel >= DEGRADATION_FAST_SCALING);
+                const double conversionStart = GetHiResTime();
+                converted = converter.convert(job.frame, ff->m_pixelFormat, width, height,
+                                              &current_frame->m_image);
+                const double conversionEnd = GetHiResTime();
+                ff->m_statistics.imageConversion.add(conversionEnd - conversionStart);
+                TraceRecorder::instance().addSpan("convert", conversionStart, conversionEnd);
+
+                assert(converted && "sws_scale failed");
+                if (!converted)
+                {
+                    BOOST_LOG_TRIVIAL(error) << "sws_scale failed";
+                }
+            }
+        }
+
+        {
+            boost::lock_guard<boost::mutex> locker(ff->m_videoFramesMutex);
+            --frames.m_converting;
+            converted = converted && ff->m_videoPacketsQueue.generation() == job.generation;
+            if (converted)
+            {
+                current_frame->m_displayTime = job.displayTime;
+                current_frame->m_duration = job.duration;
+
+                frames.m_write_counter = (frames.m_write_counter + 1) %
+                                         (sizeof(frames.m_frames) / sizeof(frames.m_frames[0]));
+                ++frames.m_busy;
+                assert(frames.m_busy + frames.m_converting <= MAX_VIDEO_PICTURE_QUEUE_SIZE);
+            }
+        }
+        ff->m_videoFramesCV.notify_all();
+
+        if (converted && job.seekRequestTime > 0)
+        {
+            ff->m_statistics.seekLatency.add(GetHiResTime() - job.seekRequestTime);
+        }
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "ffmpegdecoder.h"
+
+// Conversion stage between the video decoder thread and the display: turns the decoded
+// frames handed over in m_conversionJobs into VQueue pictures, in order.
+class ConvertRunnable
+{
+	FFmpegDecoder* m_ffmpeg;
+
+public:
+	explicit ConvertRunnable(FFmpegDecoder* parent)
+		: m_ffmpeg(parent)
+	{}
+	void operator()();
+};
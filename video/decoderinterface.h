@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include <memory>
 #include <string>
+#include <vector>
 
 #ifdef _WIN32
 typedef std::wstring PathType;
@@ -13,10 +14,117 @@ typedef std::string PathType;
 struct FrameRenderingData
 {
 	uint8_t** image;
+	int* pitch;  // bytes per row of each plane, padding included
 	int width; 
 	int height;
 };
 
+// Downscaled keyframe for seek bar previews.
+struct Thumbnail
+{
+	long long position;        // keyframe position, in the units of changedFramePosition
+	int width;
+	int height;
+	std::vector<uint8_t> rgb;  // packed RGB24, rows of width * 3 bytes
+};
+
+// Log2-bucketed latency distribution; bucket i counts samples below 2^i microseconds
+// (and not below 2^(i-1) microseconds), the last bucket also takes everything longer.
+struct LatencyHistogramData
+{
+	enum { BUCKET_COUNT = 24 };
+
+	uint64_t buckets[BUCKET_COUNT];
+	uint64_t count;
+	double totalSecs;
+	double maxSecs;
+
+	double mean() const { return count ? totalSecs / count : 0.; }
+
+	// Upper bound of the bucket holding the given fraction (0..1) of samples.
+	double percentile(double fraction) const
+	{
+		const double target = fraction * count;
+		uint64_t accumulated = 0;
+		for (int i = 0; i < BUCKET_COUNT; ++i)
+		{
+			accumulated += buckets[i];
+			if (accumulated > 0 && accumulated >= target)
+				return (i == BUCKET_COUNT - 1) ? maxSecs : (1LL << i) / 1000000.;
+		}
+		return 0.;
+	}
+};
+
+// Steps taken in turn while video decoding can't keep up with the clock, each on top of
+// the ones before; undone one at a time once decoding has time to spare again.
+enum DecodingDegradation
+{
+	DEGRADATION_NONE,
+	DEGRADATION_SKIP_LOOP_FILTER,  ///< no deblocking
+	DEGRADATION_SKIP_NONREF,       ///< frames nothing is predicted from aren't decoded
+	DEGRADATION_KEYFRAMES_ONLY,
+	DEGRADATION_FAST_SCALING,      ///< cheaper filter for the conversion to the output format
+	DEGRADATION_LEVELS
+};
+
+// Fill level of a demuxed packet queue at the time of the snapshot.
+struct PacketQueueLevel
+{
+	int packets;
+	int64_t bytes;
+	double secs;
+	double targetSecs;
+	int64_t byteLimit;  // derived from the target and the measured bitrate
+	int parked;         // held back by the demuxer beyond the ring capacity
+};
+
+struct DecoderStatistics
+{
+	LatencyHistogramData videoPacketWait;     // VideoParseRunnable::getVideoPacket
+	LatencyHistogramData audioPacketWait;     // AudioParseRunnable::getAudioPacket
+	LatencyHistogramData videoDecode;         // avcodec_decode_video2
+	LatencyHistogramData imageConversion;     // ConvertRunnable, sws_scale across bands
+	LatencyHistogramData videoFrameQueueWait; // waiting for a free VQueue slot
+	LatencyHistogramData presentLateness;     // behind schedule when the frame is drawn
+	LatencyHistogramData seekLatency;         // seek request until the new position's frame is queued
+
+	uint64_t decodedFrames;
+	uint64_t hardSkippedFrames;  // decoded too late, never converted
+	uint64_t droppedFrames;      // converted but dropped by the display thread
+	uint64_t presentedFrames;
+	uint64_t passthroughFrames;  // shown straight from the decoder, no conversion
+
+	int frameQueueDepth;     // presentation queue depth now
+	int maxFrameQueueDepth;  // and the deepest it got
+
+	int degradationLevel;                       // DecodingDegradation now
+	uint64_t degradations[DEGRADATION_LEVELS];  // times decoding stepped down to each level
+
+	// Interleaving trouble: times a stream ran dry while the other's queue was
+	// full, and packets queued past the limits or parked to feed the starving one.
+	uint64_t videoStarvations;
+	uint64_t audioStarvations;
+	uint64_t overfilledPackets;
+	uint64_t parkedPackets;
+
+	// Resampled audio waiting for the output thread, which feeds the device, and the
+	// times playback went on after finding none
+	double audioRingSecs;
+	double audioRingCapacitySecs;
+	uint64_t audioRingUnderruns;
+
+	// Video decoder threading as opened; frame threading delays each frame's output
+	// by a frame per extra thread, which the sync logic allows for.
+	int decodingThreads;
+	bool frameThreading;
+	double decoderLatencySecs;
+	int lowres;  // log2 of the fraction of the resolution the video decoder was opened at
+
+	PacketQueueLevel videoQueue;
+	PacketQueueLevel audioQueue;
+};
+
 struct IFrameListener
 {
 	virtual ~IFrameListener() {}
@@ -37,6 +145,9 @@ struct FrameDecoderListener
 
 	virtual void onEndOfStream() {}
 
+	// Video quality stepped down or back up; called from the video decoding thread.
+	virtual void decodingDegraded(DecodingDegradation /*level*/) {}
+
 	virtual void playingFinished() {}
 };
 
@@ -48,10 +159,53 @@ struct IFrameDecoder
 		PIX_FMT_RGB24,     ///< packed RGB 8:8:8, 24bpp, RGBRGB...
 	};
 
+	enum ThreadingMode {
+		THREADING_AUTO,    ///< per codec and resolution: frame threading for large pictures
+		THREADING_FRAME,   ///< a frame per thread: scales best, delays output by a frame per thread
+		THREADING_SLICE,   ///< slices of one frame in parallel: no delay, needs sliced streams
+	};
+
 	virtual ~IFrameDecoder() {}
 
 	virtual void SetFrameFormat(FrameFormat format) = 0;
 
+	// Trades video quality for speed while decoding falls behind, see DecodingDegradation.
+	// On by default.
+	virtual void setAdaptiveQuality(bool enable) = 0;
+
+	// Size the view shows the video at, 0 x 0 for the video's own. Converted pictures are
+	// scaled down to fit it, keeping the aspect ratio.
+	virtual void setTargetSize(int width, int height) = 0;
+
+	// Lets codecs that can decode at a half, quarter or eighth of the resolution do so,
+	// if that still fills the target size at open. That resolution stays until the next
+	// open, so a view that grows meanwhile shows upscaled pictures. Off by default.
+	virtual void setLowresDecoding(bool enable) = 0;
+
+	// Video decoding threads, 0 for one per core. A mode the codec lacks falls back to
+	// the other one. Takes effect on the next open.
+	virtual void setDecodingThreads(int count, ThreadingMode mode) = 0;
+
+	// Frames the decoder may get ahead of the display, 2 to 16. With 0, the default, the
+	// depth follows the jitter of decode times, except for live streams, which keep the
+	// shortest queue for latency. Takes effect on the next open.
+	virtual void setFrameQueueDepth(int frames) = 0;
+
+	// Window of the I/O prefetch stage for files and byte stream URLs, 0 disables it.
+	// Takes effect on the next open.
+	virtual void setReadAheadSize(int64_t bytes) = 0;
+
+	// Exact seeks present the frame at the requested position rather than the keyframe
+	// before it, decoding the frames in between without showing them. Off by default.
+	virtual void setExactSeek(bool exact) = 0;
+
+	// Seek bar previews for files: a low priority thread with a demuxer and decoder of its
+	// own samples keyframes across the file into a cache of up to `bytes`, saved next to
+	// the file if `persist`. 0 disables it. Takes effect on the next open.
+	virtual void setThumbnailCache(int64_t bytes, bool persist) = 0;
+	// The thumbnail generated so far closest to the given position; null if none yet.
+	virtual std::shared_ptr<const Thumbnail> getThumbnail(double percent) = 0;
+
     virtual bool openFile(const PathType& file) = 0;
     virtual bool openUrl(const std::string& url) = 0;
 
@@ -61,6 +215,14 @@ struct IFrameDecoder
 
 	virtual bool seekByPercent(double percent, int64_t totalDuration = -1) = 0;
 
+	// Scrubbing, e.g. while a seek slider is dragged. Between beginScrub() and endScrub()
+	// audio is muted and scrubTo() shows just the keyframe nearest to each position,
+	// skipping positions superseded before the decoder got to them. endScrub() then does
+	// an exact seek to the last position.
+	virtual void beginScrub() = 0;
+	virtual void scrubTo(double percent) = 0;
+	virtual void endScrub() = 0;
+
 	virtual void setFrameListener(IFrameListener* listener) = 0;
 	virtual void setDecoderListener(FrameDecoderListener* listener) = 0;
 	virtual bool getFrameRenderingData(FrameRenderingData* data) = 0;
@@ -72,6 +234,9 @@ struct IFrameDecoder
 	virtual bool isPaused() const = 0;
 	virtual double volume() const = 0;
 	virtual double getDurationSecs(int64_t duration) const = 0;
+
+	// Snapshot of the pipeline counters since the current file was opened.
+	virtual DecoderStatistics getStatistics() const = 0;
 };
 
 struct IAudioPlayer;
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "decoderinterface.h"
+
+#include <boost/atomic.hpp>
+
+// Lock-free counterpart of LatencyHistogramData, written from the pipeline threads.
+class LatencyHistogram
+{
+   public:
+    LatencyHistogram() { reset(); }
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void add(double secs)
+    {
+        const uint64_t us = (secs > 0) ? uint64_t(secs * 1000000.) : 0;
+
+        int bucket = 0;
+        while (bucket < LatencyHistogramData::BUCKET_COUNT - 1 && (us >> bucket) != 0)
+        {
+            ++bucket;
+        }
+
+        m_buckets[bucket].fetch_add(1, boost::memory_order_relaxed);
+        m_count.fetch_add(1, boost::memory_order_relaxed);
+        m_totalUs.fetch_add(us, boost::memory_order_relaxed);
+
+        for (uint64_t v = m_maxUs.load(boost::memory_order_relaxed);
+             v < us && !m_maxUs.compare_exchange_weak(v, us, boost::memory_order_relaxed);)
+        {
+        }
+    }
+
+    void snapshot(LatencyHistogramData* data) const
+    {
+        for (int i = 0; i < LatencyHistogramData::BUCKET_COUNT; ++i)
+        {
+            data->buckets[i] = m_buckets[i].load(boost::memory_order_relaxed);
+        }
+        data->count = m_count.load(boost::memory_order_relaxed);
+        data->totalSecs = m_totalUs.load(boost::memory_order_relaxed) / 1000000.;
+        data->maxSecs = m_maxUs.load(boost::memory_order_relaxed) / 1000000.;
+    }
+
+    void reset()
+    {
+        for (auto& bucket : m_buckets)
+        {
+            bucket = 0;
+        }
+        m_count = 0;
+        m_totalUs = 0;
+        m_maxUs = 0;
+    }
+
+   private:
+    boost::atomic<uint64_t> m_buckets[LatencyHistogramData::BUCKET_COUNT];
+    boost::atomic<uint64_t> m_count;
+    boost::atomic<uint64_t> m_totalUs;
+    boost::atomic<uint64_t> m_maxUs;
+};
+
+struct PipelineStatistics
+{
+    LatencyHistogram videoPacketWait;
+    LatencyHistogram audioPacketWait;
+    LatencyHistogram videoDecode;
+    LatencyHistogram imageConversion;
+    LatencyHistogram videoFrameQueueWait;
+    LatencyHistogram presentLateness;
+    LatencyHistogram seekLatency;
+
+    boost::atomic<uint64_t> decodedFrames;
+    boost::atomic<uint64_t> hardSkippedFrames;
+    boost::atomic<uint64_t> droppedFrames;
+    boost::atomic<uint64_t> presentedFrames;
+    boost::atomic<uint64_t> passthroughFrames;
+
+    boost::atomic<int> frameQueueDepth;
+    boost::atomic<int> maxFrameQueueDepth;
+
+    boost::atomic<int> degradationLevel;
+    boost::atomic<uint64_t> degradations[DEGRADATION_LEVELS];
+
+    boost::atomic<uint64_t> videoStarvations;
+    boost::atomic<uint64_t> audioStarvations;
+    boost::atomic<uint64_t> overfilledPackets;
+    boost::atomic<uint64_t> parkedPackets;
+
+    boost::atomic<uint64_t> audioRingUnderruns;
+
+    PipelineStatistics() { reset(); }
+
+    void snapshot(DecoderStatistics* stats) const
+    {
+        videoPacketWait.snapshot(&stats->videoPacketWait);
+        audioPacketWait.snapshot(&stats->audioPacketWait);
+        videoDecode.snapshot(&stats->videoDecode);
+        imageConversion.snapshot(&stats->imageConversion);
+        videoFrameQueueWait.snapshot(&stats->videoFrameQueueWait);
+        presentLateness.snapshot(&stats->presentLateness);
+        seekLatency.snapshot(&stats->seekLatency);
+
+        stats->decodedFrames = decodedFrames;
+        stats->hardSkippedFrames = hardSkippedFrames;
+        stats->droppedFrames = droppedFrames;
+        stats->presentedFrames = presentedFrames;
+        stats->passthroughFrames = passthroughFrames;
+
+        stats->frameQueueDepth = frameQueueDepth;
+        stats->maxFrameQueueDepth = maxFrameQueueDepth;
+
+        stats->degradationLevel = degradationLevel;
+        for (int i = 0; i < DEGRADATION_LEVELS; ++i)
+        {
+            stats->degradations[i] = degradations[i];
+        }
+
+        stats->videoStarvations = videoStarvations;
+        stats->audioStarvations = audioStarvations;
+        stats->overfilledPackets = overfilledPackets;
+        stats->parkedPackets = parkedPackets;
+
+        stats->audioRingUnderruns = audioRingUnderruns;
+    }
+
+    void reset()
+    {
+        videoPacketWait.reset();
+        audioPacketWait.reset();
+        videoDecode.reset();
+        imageConversion.reset();
+        videoFrameQueueWait.reset();
+        presentLateness.reset();
+        seekLatency.reset();
+
+        decodedFrames = 0;
+        hardSkippedFrames = 0;
+        droppedFrames = 0;
+        presentedFrames = 0;
+        passthroughFrames = 0;
+
+        frameQueueDepth = 0;
+        maxFrameQueueDepth = 0;
+
+        degradationLevel = DEGRADATION_NONE;
+        for (auto& count : degradations)
+        {
+            count = 0;
+        }
+
+        videoStarvations = 0;
+        audioStarvations = 0;
+        overfilledPackets = 0;
+        parkedPackets = 0;
+
+        audioRingUnderruns = 0;
+    }
+};
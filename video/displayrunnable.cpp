@@ -3,6 +3,7 @@
 void DisplayRunnable::operator()()
 {
     CHANNEL_LOG(ffmpeg_threads) << "Displaying thread started";
+    TraceRecorder::instance().setThreadName("display");
     FFmpegDecoder* ff = m_ffmpeg;
 
     for (;;)
@@ -23,6 +24,7 @@ void DisplayRunnable::operator()()
         if (ff->m_videoFramesQueue.m_busy > 1 && current_frame->m_displayTime < GetHiResTime())
         {
             CHANNEL_LOG(ffmpeg_threads) << __FUNCTION__ << " Framedrop";
+            ++ff->m_statistics.droppedFrames;
             ff->finishedDisplayingFrame();
             continue;
         }
@@ -51,12 +53,16 @@ void DisplayRunnable::operator()()
             break;
         }
 
+        ff->m_statistics.presentLateness.add(GetHiResTime() - current_frame->m_displayTime);
+        ++ff->m_statistics.presentedFrames;
+
         // It's time to display converted frame
         if (ff->m_decoderListener)
             ff->m_decoderListener->changedFramePosition(current_frame->m_duration, ff->m_duration);
 
         if (ff->m_frameListener)
         {
+            TRACE_SPAN("present");
             ff->m_frameListener->drawFrame();
         }
         else
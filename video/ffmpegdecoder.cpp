@@ -1,22 +1,72 @@
 ﻿#include "ffmpegdecoder.h"
+#include <errno.h>
 #include <limits.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "parserunnable.h"
 #include "displayrunnable.h"
+#include "framepool.h"
+#include "keyframeindex.h"
+#include "keyframeindexrunnable.h"
 #include "makeguard.h"
+#include "probecache.h"
+#include "readaheadbuffer.h"
+#include "thumbnailcache.h"
+#include "thumbnailrunnable.h"
 
 #include <boost/chrono.hpp>
+#include <algorithm>
 #include <utility>
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sys/vfs.h>
+#endif
+
 #include <boost/log/trivial.hpp>
 
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(55,28,1)
 #define av_frame_alloc  avcodec_alloc_frame
 #endif
 
+#ifndef AV_CODEC_CAP_FRAME_THREADS
+#define AV_CODEC_CAP_FRAME_THREADS  CODEC_CAP_FRAME_THREADS
+#define AV_CODEC_CAP_SLICE_THREADS  CODEC_CAP_SLICE_THREADS
+#endif
+
+#ifndef AV_CODEC_CAP_DR1
+#define AV_CODEC_CAP_DR1  CODEC_CAP_DR1
+#endif
+
 namespace
 {
+#ifndef _WIN32
+inline int fopen_s(FILE **fh, const char *filename, const char *mode)
+{
+    *fh = fopen(filename, mode);
+    return (*fh == nullptr) ? errno : 0;
+}
+
+inline int _fseeki64(FILE *fh, int64_t offset, int whence) { return fseeko(fh, offset, whence); }
+inline int64_t _ftelli64(FILE *fh) { return ftello(fh); }
+#endif
+
 // https://gist.github.com/xlphs/9895065
 class MyIOContext
 {
@@ -25,14 +75,61 @@ class MyIOContext
     uint8_t *buffer;  // internal buffer for ffmpeg
     int bufferSize;
     FILE *fh;
+    // Cached at open, -1 if unknown. Dropped when mapped reads fall back to stdio, which
+    // happens on the thread reading the source while FFmpeg's may be asking for it
+    boost::atomic<int64_t> fileSize;
+
+    // Whole-file read-only view of a local file; reads are served from it while the file
+    // keeps the size it was mapped at, and through stdio once it doesn't
+    const uint8_t *mapped;
+    int64_t position;
+    int64_t advisedEnd;
+    int64_t checkedEnd;  // the size was last checked for reads up to here
+#ifdef _WIN32
+    HANDLE mappingHandle;
+#endif
+
+    // Byte stream URL opened through avio, used for network input
+    AVIOContext *urlCtx;
+    boost::atomic_bool interrupted;
+
+    // Callbacks reading the underlying file or URL
+    int (*sourceRead)(void *, uint8_t *, int);
+    int64_t (*sourceSeek)(void *, int64_t, int);
+
+    std::unique_ptr<ReadAheadBuffer> readAhead;
 
    public:
     MyIOContext(const PathType &datafile);
+    MyIOContext(const std::string &url, AVDictionary **options);
     ~MyIOContext();
 
-    void initAVFormatContext(AVFormatContext *);
+    // Probes the format unless it is already known.
+    void initAVFormatContext(AVFormatContext *, AVInputFormat *knownFormat = nullptr);
+
+    // Puts the prefetch stage between FFmpeg and the source; call before any reading.
+    void startReadAhead(int64_t size);
+
+    bool valid() const { return fh != nullptr || urlCtx != nullptr; }
+
+    void adviseReadAhead();
+
+    bool mappingValid() const;
+    void fallBackToStdio();
+
+   private:
+    void allocContext();
+    bool mapFile(const PathType &datafile);
+    void unmapFile();
+};
+
+enum
+{
+    READ_AHEAD_SIZE = 8 * 1024 * 1024,
 
-    bool valid() const { return fh != nullptr; }
+    // Stream analysis limits when the probe cache already knows the file
+    CACHED_PROBE_SIZE = 256 * 1024,
+    CACHED_ANALYZE_DURATION = AV_TIME_BASE / 2,
 };
 
 // static
@@ -56,6 +153,11 @@ int64_t IOSeekFunc(void *data, int64_t pos, int whence)
 
     if (whence == AVSEEK_SIZE)
     {
+        if (hctx->fileSize >= 0)
+        {
+            return hctx->fileSize;
+        }
+
         // return the file size if you wish to
         auto current = _ftelli64(hctx->fh);
         int rs = _fseeki64(hctx->fh, 0, SEEK_END);
@@ -76,12 +178,210 @@ int64_t IOSeekFunc(void *data, int64_t pos, int whence)
     return _ftelli64(hctx->fh);  // int64_t is usually long long
 }
 
-MyIOContext::MyIOContext(const PathType &s)
+#ifdef __linux__
+// Paging in from these can fail at any time, which mapped reads can't report
+bool isNetworkFileSystem(unsigned long type)
 {
-    // allocate buffer
-    bufferSize = 1024 * 64;                     // FIXME: not sure what size to use
-    buffer = (uint8_t *)av_malloc(bufferSize);  // see destructor for details
+    switch (type)
+    {
+    case 0x6969:      // NFS
+    case 0x517B:      // SMB
+    case 0xFF534D42:  // CIFS
+    case 0xFE534D42:  // SMB2
+    case 0x65735546:  // FUSE
+    case 0x5346414F:  // AFS
+    case 0x00C36400:  // Ceph
+    case 0x01021997:  // 9P
+        return true;
+    default:
+        return false;
+    }
+}
+#endif
+
+// Copies from the file view; false if paging it in failed
+bool copyFromView(uint8_t *dst, const uint8_t *src, int len)
+{
+#ifdef _MSC_VER
+    __try
+    {
+        memcpy(dst, src, len);
+    }
+    __except (GetExceptionCode() == EXCEPTION_IN_PAGE_ERROR ? EXCEPTION_EXECUTE_HANDLER
+                                                             : EXCEPTION_CONTINUE_SEARCH)
+    {
+        return false;
+    }
+#else
+    memcpy(dst, src, len);
+#endif
+    return true;
+}
+
+// static
+int MappedReadFunc(void *data, uint8_t *buf, int buf_size)
+{
+    MyIOContext *hctx = (MyIOContext *)data;
+
+    // Touching pages past a truncated end faults, and a grown file would end early. The
+    // size is checked again at the end and once per READ_AHEAD_SIZE / 2 bytes read; a
+    // page-in failing in between is caught by copyFromView() where that is possible.
+    const int64_t position = hctx->position;
+    const bool outsideChecked =
+        position < hctx->checkedEnd - READ_AHEAD_SIZE / 2 || position >= hctx->checkedEnd;
+    if (outsideChecked || position >= hctx->fileSize)
+    {
+        if (!hctx->mappingValid())
+        {
+            hctx->fallBackToStdio();
+            return IOReadFunc(data, buf, buf_size);
+        }
+        hctx->checkedEnd = position + READ_AHEAD_SIZE / 2;
+    }
+
+    if (hctx->position >= hctx->fileSize)
+    {
+        return AVERROR_EOF;
+    }
+
+    hctx->adviseReadAhead();
+
+    const int len = (int)std::min<int64_t>(buf_size, hctx->fileSize - hctx->position);
+    if (!copyFromView(buf, hctx->mapped + hctx->position, len))
+    {
+        hctx->fallBackToStdio();
+        return IOReadFunc(data, buf, buf_size);
+    }
+    hctx->position += len;
+    return len;
+}
+
+// static
+int64_t MappedSeekFunc(void *data, int64_t pos, int whence)
+{
+    MyIOContext *hctx = (MyIOContext *)data;
 
+    switch (whence & ~AVSEEK_FORCE)
+    {
+    case AVSEEK_SIZE:
+        return hctx->fileSize;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        pos += hctx->position;
+        break;
+    case SEEK_END:
+        pos += hctx->fileSize;
+        break;
+    default:
+        return -1LL;
+    }
+
+    if (pos < 0)
+    {
+        return -1LL;
+    }
+    hctx->position = pos;
+    return pos;
+}
+
+// The callbacks FFmpeg gets, so that the source can change underneath
+// static
+int SourceReadFunc(void *data, uint8_t *buf, int buf_size)
+{
+    MyIOContext *hctx = (MyIOContext *)data;
+    return hctx->sourceRead(data, buf, buf_size);
+}
+
+// static
+int64_t SourceSeekFunc(void *data, int64_t pos, int whence)
+{
+    MyIOContext *hctx = (MyIOContext *)data;
+    return hctx->sourceSeek(data, pos, whence);
+}
+
+// static
+int UrlReadFunc(void *data, uint8_t *buf, int buf_size)
+{
+    MyIOContext *hctx = (MyIOContext *)data;
+    const int len = avio_read(hctx->urlCtx, buf, buf_size);
+    return (len == 0) ? AVERROR_EOF : len;
+}
+
+// static
+int64_t UrlSeekFunc(void *data, int64_t pos, int whence)
+{
+    MyIOContext *hctx = (MyIOContext *)data;
+    if ((whence & ~AVSEEK_FORCE) == AVSEEK_SIZE)
+    {
+        return avio_size(hctx->urlCtx);
+    }
+    return avio_seek(hctx->urlCtx, pos, whence);
+}
+
+// static
+int UrlInterruptFunc(void *data)
+{
+    MyIOContext *hctx = (MyIOContext *)data;
+    return hctx->interrupted ? 1 : 0;
+}
+
+// static
+int ReadAheadReadFunc(void *data, uint8_t *buf, int buf_size)
+{
+    MyIOContext *hctx = (MyIOContext *)data;
+    const int len = hctx->readAhead->read(buf, buf_size);
+    if (len == 0)
+    {
+        return AVERROR_EOF;
+    }
+    return (len < 0) ? AVERROR_EXIT : len;
+}
+
+// static
+int64_t ReadAheadSeekFunc(void *data, int64_t pos, int whence)
+{
+    MyIOContext *hctx = (MyIOContext *)data;
+
+    switch (whence & ~AVSEEK_FORCE)
+    {
+    case AVSEEK_SIZE:
+        return hctx->fileSize;
+    case SEEK_SET:
+        break;
+    case SEEK_CUR:
+        pos += hctx->readAhead->position();
+        break;
+    case SEEK_END:
+        if (hctx->fileSize < 0)
+        {
+            return -1LL;
+        }
+        pos += hctx->fileSize;
+        break;
+    default:
+        return -1LL;
+    }
+
+    if (pos < 0)
+    {
+        return -1LL;
+    }
+    return hctx->readAhead->seek(pos);
+}
+
+MyIOContext::MyIOContext(const PathType &s)
+    : fileSize(-1),
+      mapped(nullptr),
+      position(0),
+      advisedEnd(0),
+      checkedEnd(0),
+#ifdef _WIN32
+      mappingHandle(nullptr),
+#endif
+      urlCtx(nullptr),
+      interrupted(false)
+{
     // open file
     auto err =
 #ifdef _WIN32
@@ -94,51 +394,443 @@ MyIOContext::MyIOContext(const PathType &s)
         // fprintf(stderr, "MyIOContext: failed to open file %s\n", s.c_str());
         BOOST_LOG_TRIVIAL(error) << "MyIOContext: failed to open file";
     }
+    else if (!mapFile(s))
+    {
+        CHANNEL_LOG(ffmpeg_opening) << "File mapping failed, reading through stdio";
+    }
+
+    sourceRead = mapped ? MappedReadFunc : IOReadFunc;
+    sourceSeek = mapped ? MappedSeekFunc : IOSeekFunc;
+
+    allocContext();
+}
+
+MyIOContext::MyIOContext(const std::string &url, AVDictionary **options)
+    : fh(nullptr),
+      fileSize(-1),
+      mapped(nullptr),
+      position(0),
+      advisedEnd(0),
+      checkedEnd(0),
+#ifdef _WIN32
+      mappingHandle(nullptr),
+#endif
+      urlCtx(nullptr),
+      interrupted(false),
+      sourceRead(UrlReadFunc),
+      sourceSeek(UrlSeekFunc)
+{
+    const AVIOInterruptCB interruptCallback = {UrlInterruptFunc, this};
+    if (avio_open2(&urlCtx, url.c_str(), AVIO_FLAG_READ, &interruptCallback, options) < 0)
+    {
+        urlCtx = nullptr;
+    }
+    else
+    {
+        fileSize = avio_size(urlCtx);
+    }
+
+    allocContext();
+}
+
+void MyIOContext::allocContext()
+{
+    // allocate buffer
+    bufferSize = 1024 * 64;                     // FIXME: not sure what size to use
+    buffer = (uint8_t *)av_malloc(bufferSize);  // see destructor for details
+
+    // allocate the AVIOContext
+    ioCtx =
+        avio_alloc_context(buffer, bufferSize,  // internal buffer and its size
+                           0,                   // write flag (1=true,0=false)
+                           (void *)this,  // user data, will be passed to our callback functions
+                           SourceReadFunc,
+                           0,  // no writing
+                           SourceSeekFunc);
+}
+
+MyIOContext::~MyIOContext()
+{
+    // stop prefetching before closing what it reads from
+    interrupted = true;
+    readAhead.reset();
+
+    if (urlCtx)
+        avio_close(urlCtx);
+
+    unmapFile();
+
+    if (fh)
+        fclose(fh);
+
+    // NOTE: ffmpeg messes up the buffer
+    // so free the buffer first then free the context
+    av_free(ioCtx->buffer);
+    ioCtx->buffer = nullptr;
+    av_free(ioCtx);
+}
+
+bool MyIOContext::mapFile(const PathType &datafile)
+{
+#ifdef _WIN32
+    // Network shares raise EXCEPTION_IN_PAGE_ERROR on I/O errors; leave them to stdio
+    wchar_t root[MAX_PATH];
+    if (!GetVolumePathNameW(datafile.c_str(), root, MAX_PATH) ||
+        GetDriveTypeW(root) == DRIVE_REMOTE)
+    {
+        return false;
+    }
+
+    struct _stat64 st;
+    if (_fstat64(_fileno(fh), &st) != 0)
+    {
+        return false;
+    }
+    if (!(st.st_mode & _S_IFREG))
+    {
+        return false;
+    }
+    fileSize = st.st_size;
+
+    // 32 bit builds may lack the address space for big files; stdio is used then
+    if (fileSize <= 0 || uint64_t(fileSize) > SIZE_MAX)
+    {
+        return false;
+    }
+
+    mappingHandle = CreateFileMapping((HANDLE)_get_osfhandle(_fileno(fh)), nullptr,
+                                      PAGE_READONLY, 0, 0, nullptr);
+    if (mappingHandle == nullptr)
+    {
+        return false;
+    }
+    mapped = (const uint8_t *)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (mapped == nullptr)
+    {
+        CloseHandle(mappingHandle);
+        mappingHandle = nullptr;
+        return false;
+    }
+    return true;
+#else
+    (void)datafile;
+
+#ifdef __linux__
+    struct statfs fs;
+    if (fstatfs(fileno(fh), &fs) != 0 || isNetworkFileSystem((unsigned long)fs.f_type))
+    {
+        return false;
+    }
+#endif
+
+    struct stat st;
+    if (fstat(fileno(fh), &st) != 0)
+    {
+        return false;
+    }
+    if (!S_ISREG(st.st_mode))
+    {
+        return false;
+    }
+    fileSize = st.st_size;
+
+    if (fileSize <= 0 || uint64_t(fileSize) > SIZE_MAX)
+    {
+        return false;
+    }
+
+    void *view = mmap(nullptr, (size_t)fileSize, PROT_READ, MAP_PRIVATE, fileno(fh), 0);
+    if (view == MAP_FAILED)
+    {
+        return false;
+    }
+    madvise(view, (size_t)fileSize, MADV_SEQUENTIAL);
+    mapped = (const uint8_t *)view;
+    return true;
+#endif
+}
+
+void MyIOContext::unmapFile()
+{
+    if (mapped == nullptr)
+    {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(mapped);
+    CloseHandle(mappingHandle);
+    mappingHandle = nullptr;
+#else
+    munmap((void *)mapped, (size_t)fileSize);
+#endif
+    mapped = nullptr;
+}
+
+bool MyIOContext::mappingValid() const
+{
+#ifdef _WIN32
+    LARGE_INTEGER size;
+    return GetFileSizeEx((HANDLE)_get_osfhandle(_fileno(fh)), &size) &&
+           size.QuadPart == fileSize;
+#else
+    struct stat st;
+    return fstat(fileno(fh), &st) == 0 && st.st_size == fileSize;
+#endif
+}
+
+// Only ever called from a read, so by the thread that owns the source
+void MyIOContext::fallBackToStdio()
+{
+    CHANNEL_LOG(ffmpeg_readpacket) << "File changed or failed to page in, reading through stdio";
+    unmapFile();
+    _fseeki64(fh, position, SEEK_SET);
+    sourceRead = IOReadFunc;
+    sourceSeek = IOSeekFunc;
+
+    // The size changed, so let the stdio seek measure it whenever asked
+    fileSize = -1;
+}
+
+// Asks the kernel to start paging in the region ahead of the read cursor. The
+// hint is renewed once the cursor leaves the first half of the advised window,
+// so sequential playback costs one syscall per READ_AHEAD_SIZE / 2 bytes.
+void MyIOContext::adviseReadAhead()
+{
+#ifndef _WIN32
+    static const int64_t pageSize = sysconf(_SC_PAGESIZE);
+
+    const int64_t advisedBegin = advisedEnd - READ_AHEAD_SIZE;
+    if (position >= advisedBegin && position < advisedEnd - READ_AHEAD_SIZE / 2)
+    {
+        return;
+    }
+
+    const int64_t begin = position & ~(pageSize - 1);
+    const int64_t end = std::min<int64_t>(begin + READ_AHEAD_SIZE, fileSize);
+    if (end > begin)
+    {
+        madvise((void *)(mapped + begin), (size_t)(end - begin), MADV_WILLNEED);
+    }
+    advisedEnd = begin + READ_AHEAD_SIZE;
+#endif
+}
+
+void MyIOContext::startReadAhead(int64_t size)
+{
+    if (size <= 0)
+    {
+        return;
+    }
+
+    // From now on the source is only touched by the prefetch thread
+    if (fileSize < 0)
+    {
+        fileSize = sourceSeek(this, 0, AVSEEK_SIZE);
+    }
+
+    readAhead.reset(new ReadAheadBuffer(
+        (size_t)size, 0,
+        [this](uint8_t *buf, int buf_size)
+        {
+            const int len = sourceRead(this, buf, buf_size);
+            return (len == AVERROR_EOF) ? 0 : len;
+        },
+        [this](int64_t pos) { return sourceSeek(this, pos, SEEK_SET); }));
+
+    ioCtx->read_packet = ReadAheadReadFunc;
+    ioCtx->seek = ReadAheadSeekFunc;
+
+    CHANNEL_LOG(ffmpeg_opening) << "Read-ahead enabled, " << size << " bytes";
+}
+
+void MyIOContext::initAVFormatContext(AVFormatContext *pCtx, AVInputFormat *knownFormat)
+{
+    pCtx->pb = ioCtx;
+    pCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    if (knownFormat)
+    {
+        pCtx->iformat = knownFormat;
+        return;
+    }
+
+    if (urlCtx)
+    {
+        return;  // avformat_open_input probes through the context
+    }
+
+    // you can specify a format directly
+    // pCtx->iformat = av_find_input_format("h264");
+
+    // or read some of the file and let ffmpeg do the guessing
+    size_t len;
+    if (mapped)
+    {
+        len = (size_t)std::min<int64_t>(bufferSize, fileSize);
+        memcpy(buffer, mapped, len);
+    }
+    else
+    {
+        len = fread(buffer, 1, bufferSize, fh);
+        if (len == 0)
+            return;
+        _fseeki64(fh, 0, SEEK_SET);  // reset to beginning of file
+    }
+
+    AVProbeData probeData = {0};
+    probeData.buf = buffer;
+    probeData.buf_size = bufferSize - 1;
+    probeData.filename = "";
+    pCtx->iformat = av_probe_input_format(&probeData, 1);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+void getQueueLevel(const FQueue& queue, PacketQueueLevel* level)
+{
+    level->packets = queue.size();
+    level->bytes = queue.packetsSize();
+    level->secs = queue.durationSecs();
+    level->targetSecs = queue.targetSecs();
+    level->byteLimit = queue.byteLimit();
+    level->parked = queue.parkedCount();
+}
+
+enum
+{
+    // FFmpeg's own cap for automatic thread counts; beyond it frame threading mostly adds delay
+    MAX_DECODING_THREADS = 16,
+    // Below this many pixels a frame decodes fast enough on few cores, so
+    // frame threading isn't worth its delay there
+    FRAME_THREADING_MIN_PIXELS = 1280 * 720,
+    SMALL_PICTURE_THREADS = 4,
+};
+
+// Picks the thread count and type before the codec is opened.
+void configureDecodingThreads(AVCodecContext* codecContext, const AVCodec* codec, int count,
+                              IFrameDecoder::ThreadingMode mode)
+{
+    if (count <= 0)
+    {
+        count = std::min<int>(std::max(1u, boost::thread::hardware_concurrency()),
+                              MAX_DECODING_THREADS);
+    }
+
+    const bool canFrame = (codec->capabilities & AV_CODEC_CAP_FRAME_THREADS) != 0;
+    const bool canSlice = (codec->capabilities & AV_CODEC_CAP_SLICE_THREADS) != 0;
+    const bool largePicture =
+        codecContext->width * codecContext->height >= FRAME_THREADING_MIN_PIXELS;
+
+    bool frame;
+    switch (mode)
+    {
+    case IFrameDecoder::THREADING_FRAME:
+        frame = canFrame;
+        break;
+    case IFrameDecoder::THREADING_SLICE:
+        frame = !canSlice;
+        break;
+    default:
+        frame = canFrame && (largePicture || !canSlice);
+        if (frame && !largePicture)
+        {
+            count = std::min<int>(count, SMALL_PICTURE_THREADS);
+        }
+        break;
+    }
 
-    // allocate the AVIOContext
-    ioCtx =
-        avio_alloc_context(buffer, bufferSize,  // internal buffer and its size
-                           0,                   // write flag (1=true,0=false)
-                           (void *)this,  // user data, will be passed to our callback functions
-                           IOReadFunc,
-                           0,  // no writing
-                           IOSeekFunc);
+    if (count == 1 || !(frame ? canFrame : canSlice))
+    {
+        codecContext->thread_count = 1;
+        return;
+    }
+    codecContext->thread_count = count;
+    codecContext->thread_type = frame ? FF_THREAD_FRAME : FF_THREAD_SLICE;
 }
 
-MyIOContext::~MyIOContext()
+// The largest width x height with the aspect ratio of the picture that fits the box;
+// never larger than the picture, and even sized for the chroma of 4:2:x formats.
+void fitInto(int width, int height, int boxWidth, int boxHeight, int* outWidth, int* outHeight)
 {
-    if (fh)
-        fclose(fh);
-
-    // NOTE: ffmpeg messes up the buffer
-    // so free the buffer first then free the context
-    av_free(ioCtx->buffer);
-    ioCtx->buffer = nullptr;
-    av_free(ioCtx);
+    *outWidth = width;
+    *outHeight = height;
+    if (boxWidth <= 0 || boxHeight <= 0 || (width <= boxWidth && height <= boxHeight))
+    {
+        return;
+    }
+    const double scale = std::min(boxWidth / double(width), boxHeight / double(height));
+    *outWidth = std::max(2, int(width * scale + 0.5) & ~1);
+    *outHeight = std::max(2, int(height * scale + 0.5) & ~1);
 }
 
-void MyIOContext::initAVFormatContext(AVFormatContext *pCtx)
+// get_buffer2 drawing decoded pictures from the FramePool, so that after a resolution
+// switch the decoder picks up memory left by the previous size rather than the system's.
+// Lays planes out as FFmpeg's own allocator does, each in a buffer of its own.
+int getPooledBuffer(AVCodecContext* codecContext, AVFrame* frame, int flags)
 {
-    pCtx->pb = ioCtx;
-    pCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    const AVPixelFormat format = (AVPixelFormat)frame->format;
+    const AVPixFmtDescriptor* descriptor = av_pix_fmt_desc_get(format);
+    if (codecContext->codec_type != AVMEDIA_TYPE_VIDEO ||
+        !(codecContext->codec->capabilities & AV_CODEC_CAP_DR1) || descriptor == nullptr ||
+        (descriptor->flags & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL)))
+    {
+        return avcodec_default_get_buffer2(codecContext, frame, flags);
+    }
 
-    // you can specify a format directly
-    // pCtx->iformat = av_find_input_format("h264");
+    int width = frame->width;
+    int height = frame->height;
+    int strideAlign[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(codecContext, &width, &height, strideAlign);
 
-    // or read some of the file and let ffmpeg do the guessing
-    size_t len = fread(buffer, 1, bufferSize, fh);
-    if (len == 0)
-        return;
-    _fseeki64(fh, 0, SEEK_SET);  // reset to beginning of file
+    // Widen until every row is aligned both for the codec and for the pool
+    int linesize[4];
+    for (int w = width;; w += w & ~(w - 1))
+    {
+        if (av_image_fill_linesizes(linesize, format, w) < 0)
+        {
+            return AVERROR(EINVAL);
+        }
+        bool aligned = true;
+        for (int i = 0; i < 4; ++i)
+        {
+            const int alignment = std::max<int>(strideAlign[i], FramePool::ALIGNMENT);
+            aligned = aligned && linesize[i] % alignment == 0;
+        }
+        if (aligned)
+        {
+            break;
+        }
+    }
 
-    AVProbeData probeData = {0};
-    probeData.buf = buffer;
-    probeData.buf_size = bufferSize - 1;
-    probeData.filename = "";
-    pCtx->iformat = av_probe_input_format(&probeData, 1);
-}
+    uint8_t* offsets[4];
+    const int total = av_image_fill_pointers(offsets, format, height, nullptr, linesize);
+    if (total < 0)
+    {
+        return total;
+    }
 
-//////////////////////////////////////////////////////////////////////////////
+    for (int i = 0; i < 4 && linesize[i] != 0; ++i)
+    {
+        const int planeSize = (i < 3 && offsets[i + 1] != nullptr)
+                                  ? int(offsets[i + 1] - offsets[i])
+                                  : int(total - (offsets[i] - offsets[0]));
+        // Same slack past the end as FFmpeg's allocator leaves
+        frame->buf[i] =
+            FramePool::instance().allocateBuffer(planeSize + 16 + FramePool::ALIGNMENT - 1);
+        if (frame->buf[i] == nullptr)
+        {
+            for (int j = 0; j < i; ++j)
+            {
+                av_buffer_unref(&frame->buf[j]);
+            }
+            return AVERROR(ENOMEM);
+        }
+        frame->data[i] = frame->buf[i]->data;
+        frame->linesize[i] = linesize[i];
+    }
+    frame->extended_data = frame->data;
+    return 0;
+}
 
 inline void call_avcodec_close(AVCodecContext** avctx)
 {
@@ -182,12 +874,29 @@ std::unique_ptr<IFrameDecoder> GetFrameDecoder(std::unique_ptr<IAudioPlayer> aud
 FFmpegDecoder::FFmpegDecoder(std::unique_ptr<IAudioPlayer> audioPlayer)
     : m_frameListener(nullptr),
       m_decoderListener(nullptr),
+      m_exactSeek(false),
       m_audioSettings({48000, 2, av_get_default_channel_layout(2), AV_SAMPLE_FMT_S16}),
       m_pixelFormat(AV_PIX_FMT_YUV420P),
-      m_audioPlayer(std::move(audioPlayer))
+      m_readAheadSize(0),
+      m_decodingThreads(0),
+      m_threadingMode(THREADING_AUTO),
+      m_frameQueueDepth(0),
+      m_adaptiveFrameQueue(false),
+      m_adaptiveQuality(true),
+      m_targetWidth(0),
+      m_targetHeight(0),
+      m_lowresDecoding(false),
+      m_videoPacketsQueue(PACKET_QUEUE_CAPACITY, VIDEO_BUFFER_SECS),
+      m_audioPacketsQueue(PACKET_QUEUE_CAPACITY, AUDIO_BUFFER_SECS),
+      m_audioPlayer(std::move(audioPlayer)),
+      m_thumbnailCacheSize(0),
+      m_persistThumbnails(false)
 {
     m_audioPlayer->SetCallback(this);
 
+    m_videoPacketsQueue.setStarvationPeer(&m_audioPacketsQueue);
+    m_audioPacketsQueue.setStarvationPeer(&m_videoPacketsQueue);
+
     resetVariables();
 
     // init codecs
@@ -212,11 +921,19 @@ void FFmpegDecoder::resetVariables()
     m_videoStream = nullptr;
     m_audioStream = nullptr;
 
+    m_activeDecodingThreads = 0;
+    m_frameThreading = false;
+    m_decoderLatency = 0;
+    m_lowres = 0;
+
+    m_audioOutputPaused = false;
+    m_audioOutputReset = false;
+    m_degradationLevel = DEGRADATION_NONE;
+    m_videoDrainGeneration = -1;
+
     m_frameTotalCount = 0;
     m_duration = 0;
 
-    m_imageCovertContext = nullptr;
-
     m_audioPTS = 0;
 
     m_frameDisplayingRequested = false;
@@ -224,12 +941,24 @@ void FFmpegDecoder::resetVariables()
     m_isPaused = false;
 
     m_seekDuration = -1;
+    m_seekRequestTime = 0;
+    m_seekTarget = AV_NOPTS_VALUE;
+    m_scrubbing = false;
+    m_scrubSeek = false;
+    m_scrubPosition = -1;
+    m_exactSeekOnce = false;
 
     m_isAudioSeekingWhilePaused = false;
     m_isVideoSeekingWhilePaused = false;
 
     m_isPlaying = false;
 
+    setKeyframeIndex(nullptr);
+    {
+        boost::lock_guard<boost::mutex> locker(m_thumbnailsMutex);
+        m_thumbnails.reset();
+    }
+
     CHANNEL_LOG(ffmpeg_closing) << "Variables reset";
 }
 
@@ -238,6 +967,16 @@ void FFmpegDecoder::close()
     CHANNEL_LOG(ffmpeg_closing) << "Start file closing";
 
     CHANNEL_LOG(ffmpeg_closing) << "Aborting threads";
+    if (m_keyframeIndexThread)
+    {
+        m_keyframeIndexThread->interrupt();
+        m_keyframeIndexThread->join();
+    }
+    if (m_thumbnailThread)
+    {
+        m_thumbnailThread->interrupt();
+        m_thumbnailThread->join();
+    }
     if (m_mainParseThread)  // controls other threads, hence stop first
     {
         m_mainParseThread->interrupt();
@@ -248,11 +987,21 @@ void FFmpegDecoder::close()
         m_mainVideoThread->interrupt();
         m_mainVideoThread->join();
     }
+    if (m_mainConvertThread)
+    {
+        m_mainConvertThread->interrupt();
+        m_mainConvertThread->join();
+    }
     if (m_mainAudioThread)
     {
         m_mainAudioThread->interrupt();
         m_mainAudioThread->join();
     }
+    if (m_audioOutputThread)
+    {
+        m_audioOutputThread->interrupt();
+        m_audioOutputThread->join();
+    }
     if (m_mainDisplayThread)
     {
         m_mainDisplayThread->interrupt();
@@ -271,21 +1020,30 @@ void FFmpegDecoder::closeProcessing()
 {
     m_audioPacketsQueue.clear();
     m_videoPacketsQueue.clear();
+    m_audioPacketsQueue.resetBitrate();
+    m_videoPacketsQueue.resetBitrate();
 
     CHANNEL_LOG(ffmpeg_closing) << "Closing old vars";
 
     m_mainVideoThread.reset();
     m_mainAudioThread.reset();
+    m_audioOutputThread.reset();
     m_mainParseThread.reset();
+    m_mainConvertThread.reset();
     m_mainDisplayThread.reset();
+    m_keyframeIndexThread.reset();
+    m_thumbnailThread.reset();
 
     m_audioPlayer->Reset();
 
     // Free videoFrames
+    for (auto& job : m_conversionJobs)
+    {
+        av_frame_free(&job.frame);
+    }
+    m_conversionJobs.clear();
     m_videoFramesQueue.clear();
 
-    sws_freeContext(m_imageCovertContext);
-
     av_free(m_audioFrame);
 
     if (m_audioSwrContext)
@@ -294,7 +1052,7 @@ void FFmpegDecoder::closeProcessing()
     }
 
     // Free the YUV frame
-    av_free(m_videoFrame);
+    av_frame_free(&m_videoFrame);
 
     // Close the codec
     call_avcodec_close(&m_videoCodecContext);
@@ -307,10 +1065,7 @@ void FFmpegDecoder::closeProcessing()
     // Close video file
     if (m_formatContext)
     {
-        MyIOContext *hctx =
-            m_formatContext->pb ? (MyIOContext *)m_formatContext->pb->opaque : nullptr;
-        avformat_close_input(&m_formatContext);
-        delete hctx;
+        closeInput(&m_formatContext);
         isFileReallyClosed = true;
     }
 
@@ -329,6 +1084,16 @@ void FFmpegDecoder::closeProcessing()
         m_decoderListener->decoderClosed();
 }
 
+// static
+void FFmpegDecoder::closeInput(AVFormatContext **formatContext)
+{
+    MyIOContext *hctx = ((*formatContext)->pb && ((*formatContext)->flags & AVFMT_FLAG_CUSTOM_IO))
+                            ? (MyIOContext *)(*formatContext)->pb->opaque
+                            : nullptr;
+    avformat_close_input(formatContext);
+    delete hctx;
+}
+
 bool FFmpegDecoder::openFile(const PathType& filename)
 {
     return openDecoder(filename, std::string(), true);
@@ -343,46 +1108,105 @@ bool FFmpegDecoder::openDecoder(const PathType &file, const std::string& url, bo
 {
     close();
 
-    std::unique_ptr<MyIOContext> ioCtx;
-    if (isFile)
-    {
-        ioCtx.reset(new MyIOContext(file));
-        if (!ioCtx->valid())
-        {
-            BOOST_LOG_TRIVIAL(error) << "Couldn't open video/audio file";
-            return false;
-        }
-    }
+    m_statistics.reset();
 
     AVDictionary *streamOpts = nullptr;
     auto avOptionsGuard = MakeGuard(&streamOpts, av_dict_free);
 
-    m_formatContext = avformat_alloc_context();
-    if (isFile)
+    if (!isFile)
     {
-        ioCtx->initAVFormatContext(m_formatContext);
+        av_dict_set(&streamOpts, "stimeout", "5000000", 0); // 5 seconds timeout.
     }
-    else
+
+    FileStamp fileStamp;
+    const bool hasFileStamp = isFile && GetFileStamp(file, &fileStamp);
+
+    ProbeInfo cachedProbe;
+    AVInputFormat *cachedFormat = nullptr;
+    if (hasFileStamp && ProbeCache::instance().lookup(file, fileStamp, &cachedProbe))
     {
-        av_dict_set(&streamOpts, "stimeout", "5000000", 0); // 5 seconds timeout.
+        cachedFormat = av_find_input_format(cachedProbe.formatName.c_str());
     }
 
+    std::unique_ptr<MyIOContext> ioCtx;
     auto formatContextGuard = MakeGuard(&m_formatContext, avformat_close_input);
 
-    // Open video file
-    const int error = avformat_open_input(&m_formatContext, url.c_str(), nullptr, &streamOpts);
-    if (error != 0)
+    // Opens the input and retrieves stream information; with the cached format of a
+    // known file it only takes a short look
+    auto openInput = [&](AVInputFormat* format) -> bool
+    {
+        if (isFile)
+        {
+            ioCtx.reset(new MyIOContext(file));
+            if (!ioCtx->valid())
+            {
+                BOOST_LOG_TRIVIAL(error) << "Couldn't open video/audio file";
+                return false;
+            }
+        }
+        else if (m_readAheadSize > 0)
+        {
+            // Byte stream protocols get read-ahead too; others (e.g. RTSP) are opened directly
+            ioCtx.reset(new MyIOContext(url, &streamOpts));
+            if (!ioCtx->valid())
+            {
+                CHANNEL_LOG(ffmpeg_opening) << "No byte stream for the URL, opening it directly";
+                ioCtx.reset();
+            }
+        }
+
+        m_formatContext = avformat_alloc_context();
+        if (ioCtx)
+        {
+            ioCtx->initAVFormatContext(m_formatContext, format);
+            ioCtx->startReadAhead(m_readAheadSize);
+        }
+
+        // Open video file
+        const int error = avformat_open_input(&m_formatContext, url.c_str(), nullptr, &streamOpts);
+        if (error != 0)
+        {
+            BOOST_LOG_TRIVIAL(error) << "Couldn't open video/audio file error: " << error;
+            return false;
+        }
+        CHANNEL_LOG(ffmpeg_opening) << "Opening video/audio file...";
+
+        if (format)
+        {
+            m_formatContext->probesize = CACHED_PROBE_SIZE;
+            m_formatContext->max_analyze_duration = CACHED_ANALYZE_DURATION;
+        }
+
+        if (avformat_find_stream_info(m_formatContext, nullptr) < 0)
+        {
+            CHANNEL_LOG(ffmpeg_opening) << "Couldn't find stream information";
+            return false;
+        }
+        return true;
+    };
+
+    if (!openInput(cachedFormat))
     {
-        BOOST_LOG_TRIVIAL(error) << "Couldn't open video/audio file error: " << error;
         return false;
     }
-    CHANNEL_LOG(ffmpeg_opening) << "Opening video/audio file...";
 
-    // Retrieve stream information
-    if (avformat_find_stream_info(m_formatContext, nullptr) < 0)
+    // A second avformat_find_stream_info() on the same context wouldn't start over, so a
+    // full probe takes reopening the file
+    if (cachedFormat && !cachedProbe.apply(m_formatContext))
     {
-        CHANNEL_LOG(ffmpeg_opening) << "Couldn't find stream information";
-        return false;
+        CHANNEL_LOG(ffmpeg_opening) << "Streams differ from the cached probe, analyzing fully";
+        cachedFormat = nullptr;
+        avformat_close_input(&m_formatContext);
+        ioCtx.reset();
+        if (!openInput(nullptr))
+        {
+            return false;
+        }
+    }
+
+    if (hasFileStamp && !cachedFormat)
+    {
+        ProbeCache::instance().store(file, fileStamp, ProbeInfo::capture(m_formatContext));
     }
 
     // Find the first video stream
@@ -448,11 +1272,6 @@ bool FFmpegDecoder::openDecoder(const PathType &file, const std::string& url, bo
     auto videoCodecContextGuard = MakeGuard(&m_videoCodecContext, call_avcodec_close);
     auto audioCodecContextGuard = MakeGuard(&m_audioCodecContext, call_avcodec_close);
 
-    // Multithread decoding
-    m_videoCodecContext->thread_count = 1;
-
-    m_videoCodecContext->flags2 |= CODEC_FLAG2_FAST;
-
     // Find the decoder for the video stream
     if (m_videoStreamNumber >= 0)
     {
@@ -462,6 +1281,40 @@ bool FFmpegDecoder::openDecoder(const PathType &file, const std::string& url, bo
             assert(false && "No such codec found");
             return false;  // Codec not found
         }
+
+        // Multithread decoding
+        configureDecodingThreads(m_videoCodecContext, m_videoCodec, m_decodingThreads,
+                                 m_threadingMode);
+        m_videoCodecContext->flags2 |= CODEC_FLAG2_FAST;
+
+        // Pictures larger than the view are thrown away in the scaling anyway; if asked
+        // to, a codec that can skips that detail in decoding, for as much as still fills
+        // the view
+        int width, height;
+        fitInto(m_videoCodecContext->width, m_videoCodecContext->height, m_targetWidth,
+                m_targetHeight, &width, &height);
+        int lowres = 0;
+        while (m_lowresDecoding && lowres < m_videoCodec->max_lowres &&
+               (m_videoCodecContext->width >> (lowres + 1)) >= width &&
+               (m_videoCodecContext->height >> (lowres + 1)) >= height)
+        {
+            ++lowres;
+        }
+        m_videoCodecContext->lowres = lowres;
+        m_lowres = lowres;
+        if (lowres > 0)
+        {
+            CHANNEL_LOG(ffmpeg_opening) << "Decoding at 1/" << (1 << lowres)
+                                        << " of the resolution for the view";
+        }
+
+        // Decoded frames get handed to the conversion stage by reference
+        m_videoCodecContext->refcounted_frames = 1;
+        m_videoCodecContext->get_buffer2 = getPooledBuffer;
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(59, 0, 100)
+        // The pool locks, so frame threads needn't hand buffer requests to the decoding thread
+        m_videoCodecContext->thread_safe_callbacks = 1;
+#endif
     }
 
     // Find audio codec
@@ -490,6 +1343,25 @@ bool FFmpegDecoder::openDecoder(const PathType &file, const std::string& url, bo
             assert(false && "This file lacks resolution");
             return false;  // Could not open codec
         }
+
+        // A frame thread hands out its picture only once all the others got a packet
+        m_activeDecodingThreads = std::max(1, m_videoCodecContext->thread_count);
+        m_frameThreading = (m_videoCodecContext->active_thread_type & FF_THREAD_FRAME) != 0;
+        if (m_frameThreading)
+        {
+            AVRational frameRate = m_videoStream->avg_frame_rate;
+            if (frameRate.num <= 0 || frameRate.den <= 0)
+            {
+                frameRate = m_videoStream->r_frame_rate;
+            }
+            if (frameRate.num > 0 && frameRate.den > 0)
+            {
+                m_decoderLatency = (m_activeDecodingThreads - 1) / av_q2d(frameRate);
+            }
+        }
+        CHANNEL_LOG(ffmpeg_opening) << "Video decoding threads: " << m_activeDecodingThreads
+                                    << (m_frameThreading ? " (frame)" : " (slice)")
+                                    << ", latency " << m_decoderLatency << " s";
     }
 
     // Open audio codec
@@ -510,15 +1382,35 @@ bool FFmpegDecoder::openDecoder(const PathType &file, const std::string& url, bo
     {
         return false;
     }
+    m_audioRing.open(int64_t(AUDIO_RING_SECS * m_audioSettings.frequency) * audioFrameBytes(),
+                     audioFrameBytes());
 
     m_videoFrame = av_frame_alloc();
     m_audioFrame = av_frame_alloc();
 
+    // Live streams keep the presentation queue short, as every frame queued adds latency
+    const bool isLive = !isFile && m_formatContext->duration == AV_NOPTS_VALUE;
+    m_adaptiveFrameQueue = m_frameQueueDepth <= 0 && !isLive;
+    const int frameQueueDepth =
+        (m_frameQueueDepth > 0)
+            ? std::min<int>(std::max<int>(m_frameQueueDepth, MIN_VIDEO_PICTURE_QUEUE_SIZE),
+                            MAX_VIDEO_PICTURE_QUEUE_SIZE)
+            : MIN_VIDEO_PICTURE_QUEUE_SIZE;
+    m_videoFramesQueue.setDepth(frameQueueDepth);
+    m_statistics.frameQueueDepth = frameQueueDepth;
+    m_statistics.maxFrameQueueDepth = frameQueueDepth;
+
     audioCodecContextGuard.release();
     videoCodecContextGuard.release();
     formatContextGuard.release();
     ioCtx.release();
 
+    if (isFile)
+    {
+        startKeyframeIndexing(file);
+        startThumbnailing(file);
+    }
+
     if (m_decoderListener)
         m_decoderListener->fileLoaded();
 
@@ -545,63 +1437,168 @@ void FFmpegDecoder::play(bool isPaused)
     }
 }
 
-void FFmpegDecoder::AppendFrameClock(double frame_clock)
+void FFmpegDecoder::startKeyframeIndexing(const PathType &file)
 {
-    for (double v = m_audioPTS;
-         !m_audioPTS.compare_exchange_weak(v, v + frame_clock);)
+    // Containers with an index of their own seek well enough already
+    if (m_videoStreamNumber < 0 || m_videoStream->nb_index_entries > 0 ||
+        (m_formatContext->iformat->flags & AVFMT_NO_BYTE_SEEK))
     {
+        return;
     }
-}
 
-void FFmpegDecoder::setVolume(double volume)
-{
-    if (volume < 0 || volume > 1.)
+    FileStamp stamp;
+    if (!GetFileStamp(file, &stamp))
     {
         return;
     }
 
-    CHANNEL_LOG(ffmpeg_volume) << "Volume: " << volume;
+    const PathType sidecar = KeyframeIndex::sidecarPath(file);
 
-    m_audioPlayer->SetVolume(volume);
+    auto index = std::make_shared<KeyframeIndex>();
+    if (index->load(sidecar, stamp, m_videoStreamNumber))
+    {
+        CHANNEL_LOG(ffmpeg_opening) << "Keyframe index loaded, " << index->size() << " entries";
+        setKeyframeIndex(index);
+        return;
+    }
 
-    if (m_decoderListener)
-        m_decoderListener->volumeChanged(volume);
+    // Index with a second demuxer, so playback keeps its own read position
+    AVFormatContext *formatContext = openSecondaryInput(file);
+    if (formatContext == nullptr)
+    {
+        CHANNEL_LOG(ffmpeg_opening) << "Couldn't open the file for keyframe indexing";
+        return;
+    }
+
+    m_keyframeIndexThread.reset(new boost::thread(KeyframeIndexRunnable(
+        this, formatContext, m_videoStream, sidecar, stamp)));
 }
 
-double FFmpegDecoder::volume() const { return m_audioPlayer->GetVolume(); }
+// Opens another demuxer over the open file, for background work that must not move
+// playback's read position. Close it with closeInput().
+AVFormatContext *FFmpegDecoder::openSecondaryInput(const PathType &file)
+{
+    std::unique_ptr<MyIOContext> ioCtx(new MyIOContext(file));
+    if (!ioCtx->valid())
+    {
+        return nullptr;
+    }
 
-FPicture *FFmpegDecoder::frameToImage(FPicture &videoFrameData)
+    AVFormatContext *formatContext = avformat_alloc_context();
+    ioCtx->initAVFormatContext(formatContext);
+    if (avformat_open_input(&formatContext, "", m_formatContext->iformat, nullptr) != 0)
+    {
+        return nullptr;
+    }
+    ioCtx.release();
+    return formatContext;
+}
+
+void FFmpegDecoder::startThumbnailing(const PathType &file)
 {
-    const int width = m_videoFrame->width;
-    const int height = m_videoFrame->height;
+    if (m_thumbnailCacheSize <= 0 || m_videoStreamNumber < 0 || m_duration <= 0)
+    {
+        return;
+    }
 
-    videoFrameData.reallocForSure(m_pixelFormat, width, height);
+    auto cache = std::make_shared<ThumbnailCache>(m_thumbnailCacheSize);
+    {
+        boost::lock_guard<boost::mutex> locker(m_thumbnailsMutex);
+        m_thumbnails = cache;
+    }
 
-    // Prepare image conversion
-    m_imageCovertContext =
-        sws_getCachedContext(m_imageCovertContext, m_videoFrame->width, m_videoFrame->height,
-                             (AVPixelFormat)m_videoFrame->format, width, height, m_pixelFormat,
-                             0, nullptr, nullptr, nullptr);
+    FileStamp stamp = {};
+    const bool persist = m_persistThumbnails && GetFileStamp(file, &stamp);
+    const PathType sidecar = persist ? ThumbnailCache::sidecarPath(file) : PathType();
 
-    assert(m_imageCovertContext != nullptr);
+    bool complete = false;
+    if (persist && cache->load(sidecar, stamp, m_videoStreamNumber, &complete) && complete)
+    {
+        CHANNEL_LOG(ffmpeg_opening) << "Thumbnails loaded, " << cache->size() << " entries";
+        return;
+    }
 
-    if (m_imageCovertContext == nullptr)
+    AVFormatContext *formatContext = openSecondaryInput(file);
+    if (formatContext == nullptr)
     {
-        return nullptr;
+        CHANNEL_LOG(ffmpeg_opening) << "Couldn't open the file for thumbnails";
+        return;
     }
 
-    // Doing conversion
-    if (sws_scale(m_imageCovertContext, m_videoFrame->data, m_videoFrame->linesize, 0,
-                  m_videoFrame->height, videoFrameData.data, videoFrameData.linesize) <= 0)
+    // A decoder of its own: playback's codec state is never shared. Single threaded, as
+    // lone keyframes gain nothing from frame threads and the cores are playback's.
+    AVCodecContext *codecContext = avcodec_alloc_context3(m_videoCodec);
+    bool opened =
+        codecContext != nullptr && avcodec_copy_context(codecContext, m_videoCodecContext) >= 0;
+    if (opened)
+    {
+        codecContext->thread_count = 1;
+        codecContext->refcounted_frames = 0;
+        opened = avcodec_open2(codecContext, m_videoCodec, nullptr) >= 0;
+    }
+    if (!opened)
+    {
+        CHANNEL_LOG(ffmpeg_opening) << "Couldn't open a decoder for thumbnails";
+        avcodec_free_context(&codecContext);
+        closeInput(&formatContext);
+        return;
+    }
+
+    m_thumbnailThread.reset(new boost::thread(ThumbnailRunnable(
+        formatContext, codecContext, m_videoStreamNumber, m_duration, cache, sidecar, stamp)));
+}
+
+std::shared_ptr<const Thumbnail> FFmpegDecoder::getThumbnail(double percent)
+{
+    std::shared_ptr<ThumbnailCache> cache;
+    {
+        boost::lock_guard<boost::mutex> locker(m_thumbnailsMutex);
+        cache = m_thumbnails;
+    }
+    if (!cache)
     {
-        assert(false && "sws_scale failed");
-        BOOST_LOG_TRIVIAL(error) << "sws_scale failed";
         return nullptr;
     }
+    return cache->findNearest(int64_t(m_duration * percent));
+}
+
+void FFmpegDecoder::setKeyframeIndex(std::shared_ptr<const KeyframeIndex> index)
+{
+    boost::lock_guard<boost::mutex> locker(m_keyframeIndexMutex);
+    m_keyframeIndex = std::move(index);
+}
+
+std::shared_ptr<const KeyframeIndex> FFmpegDecoder::keyframeIndex() const
+{
+    boost::lock_guard<boost::mutex> locker(m_keyframeIndexMutex);
+    return m_keyframeIndex;
+}
+
+void FFmpegDecoder::AppendFrameClock(double frame_clock)
+{
+    for (double v = m_audioPTS;
+         !m_audioPTS.compare_exchange_weak(v, v + frame_clock);)
+    {
+    }
+}
+
+void FFmpegDecoder::setVolume(double volume)
+{
+    if (volume < 0 || volume > 1.)
+    {
+        return;
+    }
+
+    CHANNEL_LOG(ffmpeg_volume) << "Volume: " << volume;
+
+    m_audioPlayer->SetVolume(volume);
 
-    return &videoFrameData;
+    if (m_decoderListener)
+        m_decoderListener->volumeChanged(volume);
 }
 
+double FFmpegDecoder::volume() const { return m_audioPlayer->GetVolume(); }
+
 void FFmpegDecoder::SetFrameFormat(FrameFormat format)
 { 
     static_assert(PIX_FMT_YUV420P == AV_PIX_FMT_YUV420P, "FrameFormat and AVPixelFormat values must coincide.");
@@ -617,6 +1614,8 @@ void FFmpegDecoder::finishedDisplayingFrame()
         boost::lock_guard<boost::mutex> locker(m_videoFramesMutex);
         --m_videoFramesQueue.m_busy;
         assert(m_videoFramesQueue.m_busy >= 0);
+        m_videoFramesQueue.recycle(
+            m_videoFramesQueue.m_frames[m_videoFramesQueue.m_read_counter]);
         // avoiding assert in VideoParseRunnable
         m_videoFramesQueue.m_read_counter =
             (m_videoFramesQueue.m_read_counter + 1) %
@@ -626,12 +1625,40 @@ void FFmpegDecoder::finishedDisplayingFrame()
     m_videoFramesCV.notify_all();
 }
 
+DecoderStatistics FFmpegDecoder::getStatistics() const
+{
+    DecoderStatistics stats;
+    m_statistics.snapshot(&stats);
+    getQueueLevel(m_videoPacketsQueue, &stats.videoQueue);
+    getQueueLevel(m_audioPacketsQueue, &stats.audioQueue);
+    stats.decodingThreads = m_activeDecodingThreads;
+    stats.frameThreading = m_frameThreading;
+    stats.decoderLatencySecs = m_decoderLatency;
+    stats.lowres = m_lowres;
+    const int audioBytesPerSecond = m_audioSettings.frequency * audioFrameBytes();
+    stats.audioRingSecs = double(m_audioRing.filledBytes()) / audioBytesPerSecond;
+    stats.audioRingCapacitySecs = double(m_audioRing.capacity()) / audioBytesPerSecond;
+    return stats;
+}
+
+void FFmpegDecoder::getOutputSize(int width, int height, int* outWidth, int* outHeight) const
+{
+    // In coarse steps, so that dragging the view's border doesn't change the size of
+    // every picture and with it the scalers and the display's surfaces
+    enum { TARGET_SIZE_STEP = 64 };
+    const int boxWidth = (m_targetWidth + TARGET_SIZE_STEP - 1) / TARGET_SIZE_STEP;
+    const int boxHeight = (m_targetHeight + TARGET_SIZE_STEP - 1) / TARGET_SIZE_STEP;
+    fitInto(width, height, boxWidth * TARGET_SIZE_STEP, boxHeight * TARGET_SIZE_STEP, outWidth,
+            outHeight);
+}
+
 bool FFmpegDecoder::seekDuration(int64_t duration)
 {
+    m_seekRequestTime = GetHiResTime();
     if (m_mainParseThread && m_seekDuration.exchange(duration) == -1)
     {
-        boost::lock_guard<boost::mutex> locker(m_packetsQueueMutex);
-        m_packetsQueueCV.notify_all();
+        m_videoPacketsQueue.notifyAll();
+        m_audioPacketsQueue.notifyAll();
     }
 
     return true;
@@ -667,6 +1694,43 @@ bool FFmpegDecoder::seekByPercent(double percent, int64_t totalDuration)
     return seekDuration(int64_t(totalDuration * percent));
 }
 
+void FFmpegDecoder::beginScrub()
+{
+    m_scrubPosition = -1;
+    m_scrubbing = true;
+
+    // The audio thread mutes itself once it looks; make it look if it waits for packets
+    m_audioPacketsQueue.notifyAll();
+}
+
+void FFmpegDecoder::scrubTo(double percent)
+{
+    if (!m_scrubbing)
+    {
+        return;
+    }
+
+    const int64_t position = int64_t(m_duration * percent);
+    m_scrubPosition = position;
+    seekDuration(position);
+}
+
+void FFmpegDecoder::endScrub()
+{
+    {
+        boost::lock_guard<boost::mutex> locker(m_isPausedMutex);
+        m_scrubbing = false;
+        m_isPausedCV.notify_all();
+    }
+
+    const int64_t position = m_scrubPosition.exchange(-1);
+    if (position >= 0)
+    {
+        m_exactSeekOnce = true;
+        seekDuration(position);
+    }
+}
+
 bool FFmpegDecoder::getFrameRenderingData(FrameRenderingData *data)
 {
     if (!m_frameDisplayingRequested || m_mainAudioThread == nullptr || m_mainVideoThread == nullptr ||
@@ -676,11 +1740,21 @@ bool FFmpegDecoder::getFrameRenderingData(FrameRenderingData *data)
     }
 
     VideoFrame &current_frame = m_videoFramesQueue.m_frames[m_videoFramesQueue.m_read_counter];
-    if (!current_frame.m_image.data)
+    if (AVFrame *source = current_frame.m_source)
+    {
+        data->image = source->data;
+        data->pitch = source->linesize;
+        data->width = source->width;
+        data->height = source->height;
+        return true;
+    }
+
+    if (!current_frame.m_image.data[0])
     {
         return false;
     }
     data->image = current_frame.m_image.data;
+    data->pitch = current_frame.m_image.linesize;
     data->width = current_frame.m_image.width;
     data->height = current_frame.m_image.height;
 
@@ -716,10 +1790,8 @@ bool FFmpegDecoder::pauseResume()
             boost::unique_lock<boost::mutex> locker(m_videoFramesMutex);
             m_videoFramesCV.notify_all();
         }
-        {
-            boost::unique_lock<boost::mutex> locker(m_packetsQueueMutex);
-            m_packetsQueueCV.notify_all();
-        }
+        m_videoPacketsQueue.notifyAll();
+        m_audioPacketsQueue.notifyAll();
         m_pauseTimer = GetHiResTime();
     }
 
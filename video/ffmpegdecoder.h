@@ -2,6 +2,8 @@
 
 #include "decoderinterface.h"
 #include "audioplayer.h"
+#include "decoderstatistics.h"
+#include "tracerecorder.h"
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -11,6 +13,7 @@ extern "C" {
 //#include <libavdevice/avdevice.h>
 }
 
+#include <deque>
 #include <string>
 #include <boost/thread/thread.hpp>
 #include <boost/atomic.hpp>
@@ -34,19 +37,33 @@ extern boost::log::sources::channel_logger_mt<>
 
 enum
 {
-    MAX_QUEUE_SIZE = (15 * 1024 * 1024),
-    MAX_VIDEO_FRAMES = 200,
-    MAX_AUDIO_FRAMES = 100,
-    VIDEO_PICTURE_QUEUE_SIZE = 2,  // enough for displaying one frame.
+    PACKET_QUEUE_CAPACITY = 1024,  // hard limit on queued packets per stream
+    MIN_PACKET_QUEUE_BYTES = 1024 * 1024,
+    MAX_PACKET_QUEUE_BYTES = 64 * 1024 * 1024,
+    INITIAL_PACKET_QUEUE_BYTES = 15 * 1024 * 1024,  // until the bitrate is measured
+    MIN_VIDEO_PICTURE_QUEUE_SIZE = 2,  // enough for displaying one frame.
+    MAX_VIDEO_PICTURE_QUEUE_SIZE = 16,
 };
 
+// Demuxed playing time buffered per stream
+const double VIDEO_BUFFER_SECS = 2.;
+const double AUDIO_BUFFER_SECS = 4.;
+// Resampled audio the audio thread may get ahead of the device, absorbing decode jitter
+const double AUDIO_RING_SECS = 0.5;
+// How far a queue may grow past its target while the other stream starves
+const double MAX_OVERFILL_FACTOR = 5.;
+
 #include "fpicture.h"
 #include "fqueue.h"
+#include "pcmring.h"
 #include "videoframe.h"
 #include "vqueue.h"
 
 double GetHiResTime();
 
+class KeyframeIndex;
+class ThumbnailCache;
+
 // Inspired by http://dranger.com/ffmpeg/ffmpeg.html
 
 class FFmpegDecoder : public IFrameDecoder, public IAudioPlayerCallback
@@ -63,6 +80,10 @@ class FFmpegDecoder : public IFrameDecoder, public IAudioPlayerCallback
     bool seekDuration(int64_t duration);
     bool seekByPercent(double percent, int64_t totalDuration = -1) override;
 
+    void beginScrub() override;
+    void scrubTo(double percent) override;
+    void endScrub() override;
+
     double volume() const override;
 
     inline bool isPlaying() const override { return m_isPlaying; }
@@ -84,6 +105,8 @@ class FFmpegDecoder : public IFrameDecoder, public IAudioPlayerCallback
 
     void finishedDisplayingFrame() override;
 
+    DecoderStatistics getStatistics() const override;
+
     void close() override;
     void play(bool isPaused = false) override;
     bool pauseResume() override;
@@ -93,8 +116,12 @@ class FFmpegDecoder : public IFrameDecoder, public IAudioPlayerCallback
     // Threads
     friend class ParseRunnable;
     friend class AudioParseRunnable;
+    friend class AudioOutputRunnable;
     friend class VideoParseRunnable;
     friend class DisplayRunnable;
+    friend class ConvertRunnable;
+    friend class KeyframeIndexRunnable;
+    friend class ThumbnailRunnable;
 
     // Frame display listener
     IFrameListener* m_frameListener;
@@ -106,20 +133,39 @@ class FFmpegDecoder : public IFrameDecoder, public IAudioPlayerCallback
 
     std::unique_ptr<boost::thread> m_mainVideoThread;
     std::unique_ptr<boost::thread> m_mainAudioThread;
+    std::unique_ptr<boost::thread> m_audioOutputThread;
     std::unique_ptr<boost::thread> m_mainParseThread;
+    std::unique_ptr<boost::thread> m_mainConvertThread;
     std::unique_ptr<boost::thread> m_mainDisplayThread;
+    std::unique_ptr<boost::thread> m_keyframeIndexThread;
+    std::unique_ptr<boost::thread> m_thumbnailThread;
 
     // Syncronization
     boost::atomic<double> m_audioPTS;
 
-    // Real frame number and duration from video stream
-    int64_t m_duration;
+    // Real frame number and duration from video stream. The parse thread may keep
+    // refining an estimated duration during playback.
+    boost::atomic_int64_t m_duration;
     int64_t m_frameTotalCount;
 
     // Basic stuff
     AVFormatContext* m_formatContext;
 
     boost::atomic_int64_t m_seekDuration;
+    boost::atomic<double> m_seekRequestTime;
+
+    // Exact seek mode, and the position the decoder threads skip to after the latest
+    // seek (AV_NOPTS_VALUE if they just start from the keyframe). Video time base.
+    boost::atomic_bool m_exactSeek;
+    boost::atomic_int64_t m_seekTarget;
+
+    // Set between beginScrub() and endScrub(); m_scrubSeek tells whether the latest seek
+    // was a scrub one, published like m_seekTarget
+    boost::atomic_bool m_scrubbing;
+    boost::atomic_bool m_scrubSeek;
+    boost::atomic_int64_t m_scrubPosition;
+    // Makes the next seek an exact one regardless of m_exactSeek
+    boost::atomic_bool m_exactSeekOnce;
 
     // Video Stuff
     boost::atomic<double> m_videoStartClock;
@@ -129,6 +175,19 @@ class FFmpegDecoder : public IFrameDecoder, public IAudioPlayerCallback
     AVStream* m_videoStream;
     int m_videoStreamNumber;
 
+    // Threading the video decoder was opened with, and the output delay it adds
+    int m_activeDecodingThreads;
+    bool m_frameThreading;
+    double m_decoderLatency;
+    int m_lowres;
+
+    // DecodingDegradation in effect, set by the video thread and followed by the conversion stage
+    boost::atomic_int m_degradationLevel;
+
+    // Packet queue generation whose end of stream the video thread hasn't drained the
+    // decoder for yet, -1 for none
+    boost::atomic_int m_videoDrainGeneration;
+
     // Audio Stuff
     AVCodec* m_audioCodec;
     AVCodecContext* m_audioCodecContext;
@@ -150,18 +209,42 @@ class FFmpegDecoder : public IFrameDecoder, public IAudioPlayerCallback
 
     // Stuff for converting image
     AVFrame* m_videoFrame;
-    SwsContext* m_imageCovertContext;
     AVPixelFormat m_pixelFormat;
 
-    // Video and audio queues
+    int64_t m_readAheadSize;
+
+    int m_decodingThreads;
+    ThreadingMode m_threadingMode;
+
+    // Presentation queue depth asked for, 0 to adapt it; adapting is off for live streams
+    int m_frameQueueDepth;
+    bool m_adaptiveFrameQueue;
+
+    bool m_adaptiveQuality;
+
+    // Published by the view; 0 for the picture's own size
+    boost::atomic_int m_targetWidth;
+    boost::atomic_int m_targetHeight;
+    bool m_lowresDecoding;
+
+    // Video and audio queues, each fed by the parse thread and drained by its decoder thread
     FQueue m_videoPacketsQueue;
     FQueue m_audioPacketsQueue;
 
-    boost::mutex m_packetsQueueMutex;
-    boost::condition_variable m_packetsQueueCV;
-
     VQueue m_videoFramesQueue;
 
+    // Decoded frames on their way from the video thread to the conversion stage, each
+    // holding a reserved VQueue slot; guarded by m_videoFramesMutex
+    struct ConversionJob
+    {
+        AVFrame* frame;  // a reference of its own
+        double displayTime;
+        int64_t duration;
+        unsigned generation;
+        double seekRequestTime;  // pending seek latency sample, or 0
+    };
+    std::deque<ConversionJob> m_conversionJobs;
+
     bool m_frameDisplayingRequested;
 
     boost::mutex m_videoFramesMutex;
@@ -178,18 +261,78 @@ class FFmpegDecoder : public IFrameDecoder, public IAudioPlayerCallback
     // Audio
     std::unique_ptr<IAudioPlayer> m_audioPlayer;
 
+    // Resampled audio on its way from the audio thread to the output thread, and the
+    // audio thread's requests for the device, see AudioOutputRunnable
+    PcmRing m_audioRing;
+    boost::atomic_bool m_audioOutputPaused;
+    boost::atomic_bool m_audioOutputReset;
+
+    PipelineStatistics m_statistics;
+
+    // Seek index for containers without one, loaded from the sidecar or built in the background
+    std::shared_ptr<const KeyframeIndex> m_keyframeIndex;
+    mutable boost::mutex m_keyframeIndexMutex;
+
+    // Seek bar previews, filled by the thumbnail thread; set and reset by open and close
+    int64_t m_thumbnailCacheSize;
+    bool m_persistThumbnails;
+    std::shared_ptr<ThumbnailCache> m_thumbnails;
+    boost::mutex m_thumbnailsMutex;
+
     // IAudioPlayerCallback
     void AppendFrameClock(double frame_clock) override;
 
+    int audioFrameBytes() const
+    {
+        return m_audioSettings.channels * av_get_bytes_per_sample(m_audioSettings.format);
+    }
+
     void resetVariables();
     void closeProcessing();
-    FPicture* frameToImage(FPicture& videoFrameData);
+    static void closeInput(AVFormatContext** formatContext);
 
     void setPixelFormat(AVPixelFormat format) { m_pixelFormat = format; }
 
     void SetFrameFormat(FrameFormat format) override;
 
+    void setReadAheadSize(int64_t bytes) override { m_readAheadSize = bytes; }
+
+    void setDecodingThreads(int count, ThreadingMode mode) override
+    {
+        m_decodingThreads = count;
+        m_threadingMode = mode;
+    }
+
+    void setFrameQueueDepth(int frames) override { m_frameQueueDepth = frames; }
+
+    void setAdaptiveQuality(bool enable) override { m_adaptiveQuality = enable; }
+
+    void setTargetSize(int width, int height) override
+    {
+        m_targetWidth = width;
+        m_targetHeight = height;
+    }
+    // Size to convert a width x height picture to for the view
+    void getOutputSize(int width, int height, int* outWidth, int* outHeight) const;
+
+    void setLowresDecoding(bool enable) override { m_lowresDecoding = enable; }
+
+    void setExactSeek(bool exact) override { m_exactSeek = exact; }
+
+    void setThumbnailCache(int64_t bytes, bool persist) override
+    {
+        m_thumbnailCacheSize = bytes;
+        m_persistThumbnails = persist;
+    }
+    std::shared_ptr<const Thumbnail> getThumbnail(double percent) override;
+
     bool openDecoder(const PathType& file, const std::string& url, bool isFile);
 
     void seekWhilePaused();
+
+    AVFormatContext* openSecondaryInput(const PathType& file);
+    void startKeyframeIndexing(const PathType& file);
+    void startThumbnailing(const PathType& file);
+    void setKeyframeIndex(std::shared_ptr<const KeyframeIndex> index);
+    std::shared_ptr<const KeyframeIndex> keyframeIndex() const;
 };
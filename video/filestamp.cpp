@@ -0,0 +1,22 @@
+#include "filestamp.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+bool GetFileStamp(const PathType& file, FileStamp* stamp)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_wstat64(file.c_str(), &st) != 0)
+#else
+    struct stat st;
+    if (stat(file.c_str(), &st) != 0)
+#endif
+    {
+        return false;
+    }
+
+    stamp->size = st.st_size;
+    stamp->mtime = st.st_mtime;
+    return true;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "decoderinterface.h"
+
+// Identifies one version of a file on disk, for keying data derived from its contents.
+struct FileStamp
+{
+    int64_t size;
+    int64_t mtime;  // seconds since the epoch
+
+    bool operator==(const FileStamp& other) const
+    {
+        return size == other.size && mtime == other.mtime;
+    }
+    bool operator!=(const FileStamp& other) const { return !(*this == other); }
+};
+
+bool GetFileStamp(const PathType& file, FileStamp* stamp);
@@ -1,21 +1,30 @@
 #pragma once
 
+#include "framepool.h"
+
 extern "C" {
 #include <libavcodec/avcodec.h>
+#include <libavutil/imgutils.h>
 }
 
+#include <string.h>
+#include <utility>
+
 
+// Planes live in one FramePool block, rows padded to FramePool::ALIGNMENT.
 struct FPicture : public AVPicture
 {
 	int width;
 	int height;
 	AVPixelFormat pix_fmt;
+	size_t bufferSize;
 
 	FPicture() 
 		: AVPicture()
 		, width(0)
 		, height(0)
 		, pix_fmt(AV_PIX_FMT_NONE)
+		, bufferSize(0)
 	{
 	}
 
@@ -29,15 +38,44 @@ struct FPicture : public AVPicture
 
 	void free()
 	{
-		avpicture_free(this);
+		FramePool::instance().release(data[0], bufferSize);
+		memset(data, 0, sizeof(data));
+		memset(linesize, 0, sizeof(linesize));
+		bufferSize = 0;
         width = 0;
         height = 0;
         pix_fmt = AV_PIX_FMT_NONE;
 	}
 
+	// Leaves data null if the picture couldn't be allocated.
 	void alloc(AVPixelFormat pix_fmt, int width, int height)
 	{
-		avpicture_alloc(this, pix_fmt, width, height);
+		int linesizes[4];
+		if (av_image_fill_linesizes(linesizes, pix_fmt, width) < 0)
+		{
+			return;
+		}
+		for (int i = 0; i < 4; ++i)
+		{
+			linesizes[i] = (linesizes[i] + FramePool::ALIGNMENT - 1) & ~(FramePool::ALIGNMENT - 1);
+		}
+		const int size = av_image_fill_pointers(data, pix_fmt, height, nullptr, linesizes);
+		if (size < 0)
+		{
+			return;
+		}
+
+		// Slack past the end for vector loads running over the last row
+		const size_t bytes = size + FramePool::ALIGNMENT;
+		uint8_t* buffer = FramePool::instance().allocate(bytes);
+		if (buffer == nullptr)
+		{
+			memset(data, 0, sizeof(data));
+			return;
+		}
+		av_image_fill_pointers(data, pix_fmt, height, buffer, linesizes);
+		memcpy(linesize, linesizes, sizeof(linesizes));
+		bufferSize = bytes;
 		this->width = width;
 		this->height = height;
 		this->pix_fmt = pix_fmt;
@@ -49,6 +87,15 @@ struct FPicture : public AVPicture
 		alloc(pix_fmt, width, height);
 	}
 
+	void swap(FPicture& other)
+	{
+		std::swap(static_cast<AVPicture&>(*this), static_cast<AVPicture&>(other));
+		std::swap(width, other.width);
+		std::swap(height, other.height);
+		std::swap(pix_fmt, other.pix_fmt);
+		std::swap(bufferSize, other.bufferSize);
+	}
+
 	void reallocForSure(AVPixelFormat pix_fmt, int width, int height)
 	{
 		if (pix_fmt != this->pix_fmt || width != this->width || height != this->height)
@@ -1,57 +1,372 @@
 #pragma once
 
-#include <deque>
+#include <boost/atomic.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <deque>
+#include <vector>
 
+// Bounded single-producer/single-consumer packet queue: the parse thread pushes,
+// one decoder thread pops. Push and pop are lock-free, and so are size() and
+// packetsSize(), which either side (or anybody else) may read at any time.
+//
+// A side that has to block waits on its own condition variable, which the other
+// side signals only while somebody is actually waiting there; the mutex is never
+// touched on the fast path.
+//
+// The queue is considered full once it holds targetSecs of playing time. The byte
+// ceiling follows from that target and the bitrate of recently pushed packets,
+// so a 4 s audio buffer doesn't take megabytes and a video buffer of huge intra
+// frames doesn't get arbitrarily long.
+//
+// For badly interleaved input the producer may go past these limits, and past the
+// ring capacity by parking packets in an overflow only it sees; see ParseRunnable.
+//
+// Seeks are signalled in-band: every packet is stamped with the generation current
+// when it was pushed, and the producer starts a new generation after a seek. pop()
+// throws away packets of older generations, so the consumer never has to be stopped
+// for the queue to be cleared; it flushes its decoder once it sees a new generation.
 class FQueue
 {
 public:
-	FQueue() : m_packetsSize(0) {}
+	// capacity gets rounded up to a power of two
+	FQueue(unsigned capacity, double targetSecs)
+		: m_ring(roundUpToPowerOfTwo(capacity)),
+		m_mask(unsigned(m_ring.size()) - 1),
+		m_targetSecs(targetSecs),
+		m_head(0),
+		m_tail(0),
+		m_generation(0),
+		m_packetsSize(0),
+		m_durationUs(0),
+		m_byteLimit(INITIAL_PACKET_QUEUE_BYTES),
+		m_rateBytes(0),
+		m_rateSecs(0),
+		m_parkedSize(0),
+		m_parkedDurationUs(0),
+		m_parkedCount(0),
+		m_starvationPeer(nullptr),
+		m_producerWaiting(false),
+		m_consumerWaiting(false)
+	{}
+
+	~FQueue() { clear(); }
+
+	FQueue(const FQueue&) = delete;
+	FQueue& operator=(const FQueue&) = delete;
+
+	unsigned capacity() const { return m_mask + 1; }
+
+	// Producer side; returns false if there is no free slot.
+	bool push(const AVPacket& packet, double durationSecs)
+	{
+		const Slot slot = {packet, int64_t(durationSecs * 1000000.), generation()};
+		if (!pushSlot(slot))
+		{
+			return false;
+		}
+		updateByteLimit(packet.size, durationSecs);
+		return true;
+	}
+
+	// Producer side: keeps a packet aside until flushParked() finds a free slot.
+	void park(const AVPacket& packet, double durationSecs)
+	{
+		const Slot slot = {packet, int64_t(durationSecs * 1000000.), generation()};
+		m_parked.push_back(slot);
+		m_parkedSize += packet.size;
+		m_parkedDurationUs += slot.durationUs;
+		m_parkedCount.store(int(m_parked.size()), boost::memory_order_relaxed);
+		updateByteLimit(packet.size, durationSecs);
+	}
+
+	// Producer side: moves parked packets into the ring while there is room.
+	void flushParked()
+	{
+		while (!m_parked.empty() && pushSlot(m_parked.front()))
+		{
+			m_parkedSize -= m_parked.front().packet.size;
+			m_parkedDurationUs -= m_parked.front().durationUs;
+			m_parked.pop_front();
+			m_parkedCount.store(int(m_parked.size()), boost::memory_order_relaxed);
+		}
+	}
+
+	bool hasParked() const { return !m_parked.empty(); }
+	int parkedCount() const { return m_parkedCount.load(boost::memory_order_relaxed); }
+
+	// Producer side: everything pushed or parked and not popped yet
+	int64_t pendingSize() const { return packetsSize() + m_parkedSize; }
+	double pendingSecs() const { return durationSecs() + m_parkedDurationUs / 1000000.; }
+
+	// Consumer side; returns false if the queue holds no packet of the current
+	// generation. Stale packets met on the way get freed.
+	bool pop(AVPacket* packet, unsigned* packetGeneration = nullptr)
+	{
+		for (;;)
+		{
+			const unsigned head = m_head.load(boost::memory_order_relaxed);
+			if (head == m_tail.load(boost::memory_order_acquire))
+			{
+				return false;
+			}
+			const Slot& slot = m_ring[head & m_mask];
+			*packet = slot.packet;
+			const unsigned slotGeneration = slot.generation;
+			m_packetsSize.fetch_sub(packet->size, boost::memory_order_relaxed);
+			m_durationUs.fetch_sub(slot.durationUs, boost::memory_order_relaxed);
+			m_head.store(head + 1, boost::memory_order_release);
+
+			wake(m_producerWaiting, m_producerCV);
 
-	AVPacket dequeue()
+			if (slotGeneration == generation())
+			{
+				if (packetGeneration)
+				{
+					*packetGeneration = slotGeneration;
+				}
+				return true;
+			}
+			av_free_packet(packet);
+		}
+	}
+
+	// Producer side, after a seek: drops the parked packets and makes everything
+	// still in the ring stale.
+	void startGeneration()
 	{
-		assert(!m_queue.empty());
-		AVPacket packet = m_queue.front();
-		m_queue.pop_front();
-		m_packetsSize -= packet.size;
-		assert(m_packetsSize >= 0);
-		return packet;
+		dropParked();
+
+		m_generation.fetch_add(1, boost::memory_order_release);
+		notifyAll();
 	}
 
-	void enqueue(const AVPacket& packet)
+	unsigned generation() const { return m_generation.load(boost::memory_order_acquire); }
+
+	// Block the producer (consumer) until ready() holds. ready() is re-evaluated
+	// after every pop (push) and on notifyAll(). These are boost interruption points.
+	template <typename Predicate>
+	void waitProducer(Predicate ready) { wait(m_producerWaiting, m_producerCV, ready); }
+
+	template <typename Predicate>
+	void waitConsumer(Predicate ready)
 	{
-		m_packetsSize += packet.size;
-		assert(m_packetsSize >= 0);
-		m_queue.push_back(packet);
+		if (m_starvationPeer && !ready())
+		{
+			// Our producer may be blocked on the peer and needs to learn we ran dry
+			m_starvationPeer->wake(m_starvationPeer->m_producerWaiting,
+				m_starvationPeer->m_producerCV);
+		}
+		wait(m_consumerWaiting, m_consumerCV, ready);
 	}
 
-	int size(boost::mutex& mutex) const
+	// Queue fed by the same producer, to be woken when this one's consumer has to wait.
+	void setStarvationPeer(FQueue* peer) { m_starvationPeer = peer; }
+
+	// Less than a tenth of the target left: the consumer is about to stall.
+	bool starving() const { return size() == 0 || durationSecs() < m_targetSecs / 10; }
+
+	// Makes both sides re-check their conditions, e.g. after a seek request or pause.
+	void notifyAll()
 	{
-		boost::lock_guard<boost::mutex> locker(mutex);
-		return m_queue.size();
+		boost::lock_guard<boost::mutex> locker(m_mutex);
+		m_producerCV.notify_all();
+		m_consumerCV.notify_all();
 	}
 
 	int size() const
 	{
-		return m_queue.size();
+		return int(m_tail.load(boost::memory_order_acquire) - m_head.load(boost::memory_order_acquire));
+	}
+
+	bool empty() const { return size() == 0; }
+
+	int64_t packetsSize() const
+	{
+		return m_packetsSize.load(boost::memory_order_relaxed);
+	}
+
+	// Playing time of the queued packets
+	double durationSecs() const
+	{
+		return m_durationUs.load(boost::memory_order_relaxed) / 1000000.;
+	}
+
+	double targetSecs() const { return m_targetSecs; }
+
+	int64_t byteLimit() const { return m_byteLimit.load(boost::memory_order_relaxed); }
+
+	// Whether the producer should wait. A couple of packets get in regardless of
+	// their duration so the decoder never starves on a single long packet.
+	bool full() const
+	{
+		const int packets = size();
+		return packets > int(m_mask) || packetsSize() >= byteLimit() ||
+			(durationSecs() >= m_targetSecs && packets >= MIN_PACKETS);
 	}
 
-	int64_t	packetsSize() const
+	// Forgets the measured bitrate, for the next file. Only while both sides are stopped.
+	void resetBitrate()
 	{
-		return m_packetsSize;
+		m_rateBytes = 0;
+		m_rateSecs = 0;
+		m_byteLimit = INITIAL_PACKET_QUEUE_BYTES;
 	}
 
+	// Only while the consumer is stopped.
 	void clear()
 	{
-		for (AVPacket& packet : m_queue)
+		AVPacket packet;
+		while (pop(&packet))
 		{
 			av_free_packet(&packet);
 		}
-		m_packetsSize = 0;
-		std::deque<AVPacket>().swap(m_queue);
+		dropParked();
 	}
 
 private:
-	int64_t	m_packetsSize;
-	std::deque<AVPacket> m_queue;
+	enum
+	{
+		CACHE_LINE_SIZE = 64,
+		MIN_PACKETS = 2,
+	};
+
+	struct Slot
+	{
+		AVPacket packet;
+		int64_t durationUs;
+		unsigned generation;
+	};
+
+	// Producer side
+	void dropParked()
+	{
+		for (Slot& slot : m_parked)
+		{
+			av_free_packet(&slot.packet);
+		}
+		m_parked.clear();
+		m_parkedSize = 0;
+		m_parkedDurationUs = 0;
+		m_parkedCount = 0;
+	}
+
+	bool pushSlot(const Slot& slot)
+	{
+		const unsigned tail = m_tail.load(boost::memory_order_relaxed);
+		if (tail - m_head.load(boost::memory_order_acquire) > m_mask)
+		{
+			return false;
+		}
+		m_ring[tail & m_mask] = slot;
+		m_packetsSize.fetch_add(slot.packet.size, boost::memory_order_relaxed);
+		m_durationUs.fetch_add(slot.durationUs, boost::memory_order_relaxed);
+		m_tail.store(tail + 1, boost::memory_order_release);
+
+		wake(m_consumerWaiting, m_consumerCV);
+		return true;
+	}
+
+	// Producer side
+	void updateByteLimit(int size, double durationSecs)
+	{
+		const double RATE_DECAY = 0.995;  // averages over the last few hundred packets
+		const double MIN_RATE_SECS = 0.5;
+		const double BYTE_LIMIT_HEADROOM = 1.5;  // times what the target takes at that rate
+
+		m_rateBytes = m_rateBytes * RATE_DECAY + size;
+		m_rateSecs = m_rateSecs * RATE_DECAY + durationSecs;
+		if (m_rateSecs < MIN_RATE_SECS)
+		{
+			return;  // not enough to go on yet
+		}
+
+		const double limit = m_rateBytes / m_rateSecs * m_targetSecs * BYTE_LIMIT_HEADROOM;
+		m_byteLimit.store(std::max<int64_t>(MIN_PACKET_QUEUE_BYTES,
+			std::min<int64_t>(MAX_PACKET_QUEUE_BYTES, int64_t(limit))),
+			boost::memory_order_relaxed);
+	}
+
+	static unsigned roundUpToPowerOfTwo(unsigned value)
+	{
+		unsigned result = 1;
+		while (result < value)
+		{
+			result <<= 1;
+		}
+		return result;
+	}
+
+	void wake(boost::atomic_bool& waiting, boost::condition_variable& cv)
+	{
+		// Pairs with the fence in wait(): either the waiter sees our index update,
+		// or we see its flag.
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		if (waiting.load(boost::memory_order_relaxed))
+		{
+			boost::lock_guard<boost::mutex> locker(m_mutex);
+			cv.notify_one();
+		}
+	}
+
+	template <typename Predicate>
+	void wait(boost::atomic_bool& waiting, boost::condition_variable& cv, Predicate ready)
+	{
+		if (ready())
+		{
+			return;
+		}
+
+		boost::unique_lock<boost::mutex> locker(m_mutex);
+		waiting.store(true, boost::memory_order_relaxed);
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		try
+		{
+			while (!ready())
+			{
+				cv.wait(locker);
+			}
+		}
+		catch (...)
+		{
+			waiting.store(false, boost::memory_order_relaxed);
+			throw;
+		}
+		waiting.store(false, boost::memory_order_relaxed);
+	}
+
+	std::vector<Slot> m_ring;
+	const unsigned m_mask;
+	const double m_targetSecs;
+
+	// Indices run freely and wrap; head and tail sit on separate cache lines
+	char m_pad0[CACHE_LINE_SIZE];
+	boost::atomic<unsigned> m_head;
+	char m_pad1[CACHE_LINE_SIZE];
+	boost::atomic<unsigned> m_tail;
+	char m_pad2[CACHE_LINE_SIZE];
+
+	boost::atomic<unsigned> m_generation;
+
+	boost::atomic<int64_t> m_packetsSize;
+	boost::atomic<int64_t> m_durationUs;
+	boost::atomic<int64_t> m_byteLimit;
+
+	// Producer only
+	double m_rateBytes;
+	double m_rateSecs;
+	std::deque<Slot> m_parked;
+	int64_t m_parkedSize;
+	int64_t m_parkedDurationUs;
+
+	boost::atomic_int m_parkedCount;
+
+	FQueue* m_starvationPeer;
+
+	boost::mutex m_mutex;
+	boost::condition_variable m_producerCV;
+	boost::condition_variable m_consumerCV;
+	boost::atomic_bool m_producerWaiting;
+	boost::atomic_bool m_consumerWaiting;
 };
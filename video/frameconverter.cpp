@@ -0,0 +1,225 @@
+#include "frameconverter.h"
+#include "tracerecorder.h"
+#include "yuvconvert.h"
+
+extern "C" {
+#include <libavutil/pixdesc.h>
+}
+
+#include <algorithm>
+
+namespace
+{
+
+// Shorter bands cost more in per-scaler setup and seams than they gain in parallelism
+enum { MIN_BAND_ROWS = 64 };
+
+// Points band at the plane rows of a picture from firstRow on
+void bandPlanes(uint8_t* const planes[], const int linesize[], int chromaShift, int firstRow,
+                uint8_t* band[4])
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        const int row = (i == 1 || i == 2) ? firstRow >> chromaShift : firstRow;
+        band[i] = planes[i] ? planes[i] + ptrdiff_t(linesize[i]) * row : nullptr;
+    }
+}
+
+}  // namespace
+
+FrameConverter::FrameConverter(int threads)
+    : m_threads(std::max(1, threads)),
+      m_srcWidth(0),
+      m_srcHeight(0),
+      m_dstWidth(0),
+      m_dstHeight(0),
+      m_srcFormat(AV_PIX_FMT_NONE),
+      m_dstFormat(AV_PIX_FMT_NONE),
+      m_srcChromaShift(0),
+      m_dstChromaShift(0),
+      m_fastScaling(false),
+      m_direct(false),
+      m_frame(nullptr),
+      m_picture(nullptr),
+      m_job(0),
+      m_pending(0),
+      m_stop(false)
+{
+    for (int i = 1; i < m_threads; ++i)
+    {
+        m_workers.emplace_back(new boost::thread(&FrameConverter::workerLoop, this, size_t(i)));
+    }
+}
+
+FrameConverter::~FrameConverter()
+{
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        m_stop = true;
+    }
+    m_startCV.notify_all();
+
+    boost::this_thread::disable_interruption noInterruption;
+    for (auto& worker : m_workers)
+    {
+        worker->join();
+    }
+    for (auto& band : m_bands)
+    {
+        sws_freeContext(band.scaler);
+    }
+}
+
+bool FrameConverter::convert(const AVFrame* frame, AVPixelFormat format, int width, int height,
+                             FPicture* picture)
+{
+    picture->reallocForSure(format, width, height);
+    if (picture->data[0] == nullptr)
+    {
+        return false;
+    }
+    plan(frame, format, width, height);
+    m_direct = width == frame->width && height == frame->height && canConvertYuv(frame, format);
+
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        m_frame = frame;
+        m_picture = picture;
+        m_pending = m_workers.size();
+        ++m_job;
+    }
+    m_startCV.notify_all();
+
+    bool converted = convertBand(m_bands[0]);
+
+    // The workers write into picture, so the caller may not leave before they are done.
+    // Each worker checks in, even an idle one, so plan() may change the bands next time.
+    boost::this_thread::disable_interruption noInterruption;
+    boost::unique_lock<boost::mutex> locker(m_mutex);
+    m_doneCV.wait(locker, [this]() { return m_pending == 0; });
+    for (size_t i = 1; i < m_bands.size(); ++i)
+    {
+        converted = converted && m_bands[i].converted;
+    }
+    return converted;
+}
+
+void FrameConverter::setFastScaling(bool fast)
+{
+    // The cached scalers get rebuilt on the next band
+    m_fastScaling = fast;
+}
+
+void FrameConverter::plan(const AVFrame* frame, AVPixelFormat format, int width, int height)
+{
+    if (frame->width == m_srcWidth && frame->height == m_srcHeight && width == m_dstWidth &&
+        height == m_dstHeight && frame->format == m_srcFormat && format == m_dstFormat)
+    {
+        return;
+    }
+
+    m_srcWidth = frame->width;
+    m_srcHeight = frame->height;
+    m_dstWidth = width;
+    m_dstHeight = height;
+    m_srcFormat = (AVPixelFormat)frame->format;
+    m_dstFormat = format;
+
+    const AVPixFmtDescriptor* src = av_pix_fmt_desc_get(m_srcFormat);
+    const AVPixFmtDescriptor* dst = av_pix_fmt_desc_get(m_dstFormat);
+    m_srcChromaShift = src ? src->log2_chroma_h : 0;
+    m_dstChromaShift = dst ? dst->log2_chroma_h : 0;
+
+    // A palette belongs to the whole picture; bands start on a chroma row of both formats.
+    // When scaling, a band's source rows are those its picture rows map to, and the filter
+    // sees no rows past them; that seam is lost in the blur of a downscale.
+    const bool bandable =
+        src && dst && !((src->flags | dst->flags) & (AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL));
+    const int align = 1 << std::max(m_srcChromaShift, m_dstChromaShift);
+    const int shortest = std::min(m_srcHeight, m_dstHeight);
+    const int count = bandable ? std::max(1, std::min(m_threads, shortest / MIN_BAND_ROWS)) : 1;
+    const int rowsPerBand = std::max(align, m_dstHeight / count / align * align);
+
+    for (auto& band : m_bands)
+    {
+        sws_freeContext(band.scaler);
+    }
+    m_bands.clear();
+    auto srcRow = [this, align](int row) {
+        return int(int64_t(row) * m_srcHeight / m_dstHeight) / align * align;
+    };
+    for (int i = 0; i < count; ++i)
+    {
+        const int firstRow = i * rowsPerBand;
+        const int endRow = (i == count - 1) ? m_dstHeight : firstRow + rowsPerBand;
+        const int srcFirstRow = srcRow(firstRow);
+        const int srcEndRow = (i == count - 1) ? m_srcHeight : srcRow(endRow);
+        const Band band = {srcFirstRow, srcEndRow - srcFirstRow, firstRow, endRow - firstRow,
+                           nullptr, false};
+        m_bands.push_back(band);
+    }
+}
+
+bool FrameConverter::convertBand(Band& band)
+{
+    TRACE_SPAN("convert band");
+
+    if (m_direct)
+    {
+        convertYuvRows(m_frame, m_dstFormat, band.firstRow, band.rows, m_picture->data,
+                       m_picture->linesize);
+        return true;
+    }
+
+    // Scaling down for the view wants speed over sharpness, and bilinear is hard to tell
+    // from bicubic at that size; the cheapest filter once playback falls behind
+    const bool scaling = m_dstWidth != m_srcWidth || m_dstHeight != m_srcHeight;
+    const int flags = m_fastScaling ? SWS_FAST_BILINEAR : scaling ? SWS_BILINEAR : SWS_BICUBIC;
+    band.scaler =
+        sws_getCachedContext(band.scaler, m_srcWidth, band.srcRows, m_srcFormat, m_dstWidth,
+                             band.rows, m_dstFormat, flags, nullptr, nullptr, nullptr);
+    if (band.scaler == nullptr)
+    {
+        return false;
+    }
+
+    uint8_t* src[4];
+    uint8_t* dst[4];
+    bandPlanes(m_frame->data, m_frame->linesize, m_srcChromaShift, band.srcFirstRow, src);
+    bandPlanes(m_picture->data, m_picture->linesize, m_dstChromaShift, band.firstRow, dst);
+    return sws_scale(band.scaler, src, m_frame->linesize, 0, band.srcRows, dst,
+                     m_picture->linesize) > 0;
+}
+
+void FrameConverter::workerLoop(size_t band)
+{
+    TraceRecorder::instance().setThreadName("convert band");
+
+    unsigned job = 0;
+    for (;;)
+    {
+        {
+            boost::unique_lock<boost::mutex> locker(m_mutex);
+            m_startCV.wait(locker, [this, job]() { return m_stop || m_job != job; });
+            if (m_stop)
+            {
+                return;
+            }
+            job = m_job;
+        }
+
+        // Pictures too small for that many bands leave this worker idle
+        const bool idle = band >= m_bands.size();
+        const bool converted = idle || convertBand(m_bands[band]);
+
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        if (!idle)
+        {
+            m_bands[band].converted = converted;
+        }
+        if (--m_pending == 0)
+        {
+            m_doneCV.notify_one();
+        }
+    }
+}
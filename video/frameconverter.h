@@ -0,0 +1,76 @@
+#pragma once
+
+#include "fpicture.h"
+
+extern "C" {
+#include <libswscale/swscale.h>
+}
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <memory>
+#include <vector>
+
+// Converts decoded pictures to the output format and size. Tall pictures are cut into
+// bands of rows that convert in parallel, each through a scaler of its own or the YUV
+// kernels where they apply: the calling thread does the first band, a small pool of
+// workers the others.
+class FrameConverter
+{
+   public:
+    explicit FrameConverter(int threads);
+    ~FrameConverter();
+
+    FrameConverter(const FrameConverter&) = delete;
+    FrameConverter& operator=(const FrameConverter&) = delete;
+
+    // Reallocates picture for width x height if needed; false if conversion failed.
+    bool convert(const AVFrame* frame, AVPixelFormat format, int width, int height,
+                 FPicture* picture);
+
+    // Cheaper and coarser filtering, for when playback falls behind.
+    void setFastScaling(bool fast);
+
+   private:
+    struct Band
+    {
+        int srcFirstRow;
+        int srcRows;
+        int firstRow;  // of the picture
+        int rows;
+        SwsContext* scaler;
+        bool converted;
+    };
+
+    void plan(const AVFrame* frame, AVPixelFormat format, int width, int height);
+    bool convertBand(Band& band);
+    void workerLoop(size_t band);
+
+    const int m_threads;
+    std::vector<std::unique_ptr<boost::thread>> m_workers;
+
+    // Band layout for the current geometry
+    int m_srcWidth;
+    int m_srcHeight;
+    int m_dstWidth;
+    int m_dstHeight;
+    AVPixelFormat m_srcFormat;
+    AVPixelFormat m_dstFormat;
+    int m_srcChromaShift;  // log2 of rows per chroma row
+    int m_dstChromaShift;
+    std::vector<Band> m_bands;
+    bool m_fastScaling;
+    bool m_direct;  // through the YUV kernels rather than swscale
+
+    // Conversion in progress, handed to the workers under m_mutex
+    const AVFrame* m_frame;
+    FPicture* m_picture;
+    boost::mutex m_mutex;
+    boost::condition_variable m_startCV;
+    boost::condition_variable m_doneCV;
+    unsigned m_job;
+    size_t m_pending;
+    bool m_stop;
+};
@@ -0,0 +1,196 @@
+#include "framepool.h"
+
+#include <boost/thread/locks.hpp>
+
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <malloc.h>
+#elif defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+FramePool FramePool::s_instance;
+
+FramePool& FramePool::instance() { return s_instance; }
+
+FramePool::FramePool() : m_hugePages(false), m_byteBudget(DEFAULT_BYTE_BUDGET)
+{
+    m_statistics = Statistics();
+}
+
+FramePool::~FramePool()
+{
+    for (const auto& block : m_idle)
+    {
+        freeToSystem(block.data);
+    }
+}
+
+size_t FramePool::classSize(size_t size)
+{
+    if (size <= MIN_CLASS_SIZE)
+    {
+        return MIN_CLASS_SIZE;
+    }
+
+    // Quarter steps of the power of two below, wasting at most a fifth of a block
+    int bits = 0;
+    for (size_t rest = size - 1; rest > 1; rest >>= 1)
+    {
+        ++bits;
+    }
+    const size_t step = size_t(1) << (bits - 2);
+    return (size + step - 1) & ~(step - 1);
+}
+
+uint8_t* FramePool::allocate(size_t size)
+{
+    size = classSize(size);
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        for (auto it = m_idle.begin(); it != m_idle.end(); ++it)
+        {
+            if (it->size == size)
+            {
+                uint8_t* data = it->data;
+                m_idle.erase(it);
+                m_statistics.idleBytes -= size;
+                m_statistics.usedBytes += size;
+                ++m_statistics.hits;
+                return data;
+            }
+        }
+        ++m_statistics.misses;
+    }
+
+    uint8_t* data = allocateFromSystem(size);
+    if (data == nullptr)
+    {
+        // Make room by giving back what sits idle, then try once more
+        BlockList idle;
+        {
+            boost::lock_guard<boost::mutex> locker(m_mutex);
+            idle.swap(m_idle);
+            m_statistics.idleBytes = 0;
+        }
+        for (const auto& block : idle)
+        {
+            freeToSystem(block.data);
+        }
+        data = allocateFromSystem(size);
+        if (data == nullptr)
+        {
+            return nullptr;
+        }
+    }
+
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    m_statistics.usedBytes += size;
+    return data;
+}
+
+void FramePool::release(uint8_t* data, size_t size)
+{
+    if (data == nullptr)
+    {
+        return;
+    }
+
+    const Block block = {data, classSize(size)};
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    m_statistics.usedBytes -= block.size;
+    m_statistics.idleBytes += block.size;
+    m_idle.push_front(block);
+    trimLocked();
+}
+
+AVBufferRef* FramePool::allocateBuffer(size_t size)
+{
+    uint8_t* data = allocate(size);
+    if (data == nullptr)
+    {
+        return nullptr;
+    }
+    AVBufferRef* buffer =
+        av_buffer_create(data, int(size), releaseBuffer, reinterpret_cast<void*>(size), 0);
+    if (buffer == nullptr)
+    {
+        release(data, size);
+    }
+    return buffer;
+}
+
+void FramePool::releaseBuffer(void* opaque, uint8_t* data)
+{
+    s_instance.release(data, reinterpret_cast<size_t>(opaque));
+}
+
+void FramePool::setHugePages(bool enable)
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    m_hugePages = enable;
+}
+
+void FramePool::setByteBudget(int64_t bytes)
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    m_byteBudget = bytes;
+    trimLocked();
+}
+
+FramePool::Statistics FramePool::getStatistics() const
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    return m_statistics;
+}
+
+void FramePool::trimLocked()
+{
+    // Freeing under the lock keeps this simple; it only happens once the budget is
+    // exceeded, which settles soon after a resolution switch
+    while (m_statistics.idleBytes > m_byteBudget && !m_idle.empty())
+    {
+        m_statistics.idleBytes -= m_idle.back().size;
+        freeToSystem(m_idle.back().data);
+        m_idle.pop_back();
+    }
+}
+
+uint8_t* FramePool::allocateFromSystem(size_t size)
+{
+#ifdef _WIN32
+    // Large pages need the lock pages privilege, which a player doesn't have
+    return static_cast<uint8_t*>(_aligned_malloc(size, ALIGNMENT));
+#else
+    bool hugePages;
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        hugePages = m_hugePages;
+    }
+    const size_t alignment =
+        (hugePages && size >= HUGE_PAGE_SIZE) ? size_t(HUGE_PAGE_SIZE) : size_t(ALIGNMENT);
+
+    void* data = nullptr;
+    if (posix_memalign(&data, alignment, size) != 0)
+    {
+        return nullptr;
+    }
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    if (alignment == HUGE_PAGE_SIZE)
+    {
+        madvise(data, size & ~size_t(HUGE_PAGE_SIZE - 1), MADV_HUGEPAGE);
+    }
+#endif
+    return static_cast<uint8_t*>(data);
+#endif
+}
+
+void FramePool::freeToSystem(uint8_t* data)
+{
+#ifdef _WIN32
+    _aligned_free(data);
+#else
+    free(data);
+#endif
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+#include <boost/thread/mutex.hpp>
+
+#include <list>
+#include <stddef.h>
+#include <stdint.h>
+
+// Process-wide recycler of picture memory, shared by the decoders' frame buffers and
+// the converted images. Requests are rounded up to size classes, four per power of
+// two, so a block freed by one picture fits the next of about the same size and a
+// resolution switch reuses the memory of the old one instead of faulting in new pages.
+// Idle blocks beyond the byte budget are returned to the system, oldest first.
+class FramePool
+{
+   public:
+    enum
+    {
+        ALIGNMENT = 64,  // enough for any SIMD load the converters and decoders issue
+    };
+
+    struct Statistics
+    {
+        int64_t idleBytes;  // pooled, awaiting reuse
+        int64_t usedBytes;  // handed out and not released yet
+        uint64_t hits;
+        uint64_t misses;
+    };
+
+    static FramePool& instance();
+
+    // At least size bytes, ALIGNMENT aligned; null if out of memory.
+    uint8_t* allocate(size_t size);
+    // size as passed to allocate().
+    void release(uint8_t* data, size_t size);
+
+    // A pooled block wrapped for libav, going back to the pool when the last reference
+    // is dropped.
+    AVBufferRef* allocateBuffer(size_t size);
+
+    // Backs blocks of 2 MB and up with transparent huge pages where the system has them,
+    // cutting page faults and TLB misses on large pictures. Off by default.
+    void setHugePages(bool enable);
+    void setByteBudget(int64_t bytes);
+
+    Statistics getStatistics() const;
+
+    static size_t classSize(size_t size);
+
+   private:
+    enum
+    {
+        MIN_CLASS_SIZE = 4096,
+        HUGE_PAGE_SIZE = 2 * 1024 * 1024,
+        DEFAULT_BYTE_BUDGET = 128 * 1024 * 1024,
+    };
+
+    struct Block
+    {
+        uint8_t* data;
+        size_t size;
+    };
+    typedef std::list<Block> BlockList;
+
+    FramePool();
+    ~FramePool();
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    uint8_t* allocateFromSystem(size_t size);
+    static void freeToSystem(uint8_t* data);
+    void trimLocked();
+    static void releaseBuffer(void* opaque, uint8_t* data);
+
+    static FramePool s_instance;
+
+    mutable boost::mutex m_mutex;
+    BlockList m_idle;  // most recently released first
+    bool m_hugePages;
+    int64_t m_byteBudget;
+    Statistics m_statistics;
+};
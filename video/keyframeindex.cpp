@@ -0,0 +1,211 @@
+#include "keyframeindex.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <string.h>
+
+// Sidecar layout, little-endian:
+//   char[4]  magic "FKIX"
+//   uint32   version
+//   int64    media file size
+//   int64    media file mtime
+//   uint32   stream index
+//   uint32   entry count
+//   entries, each as two zigzag varints: pts and byte offset deltas to the previous entry
+//
+// Delta coding brings a typical entry down to 4-6 bytes.
+
+namespace
+{
+
+const char MAGIC[4] = {'F', 'K', 'I', 'X'};
+const uint32_t VERSION = 1;
+
+void putFixed(std::vector<uint8_t>* out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+    {
+        out->push_back(uint8_t(value >> (8 * i)));
+    }
+}
+
+bool getFixed(const uint8_t** p, const uint8_t* end, int bytes, uint64_t* value)
+{
+    if (end - *p < bytes)
+    {
+        return false;
+    }
+    *value = 0;
+    for (int i = 0; i < bytes; ++i)
+    {
+        *value |= uint64_t(*(*p)++) << (8 * i);
+    }
+    return true;
+}
+
+void putVarint(std::vector<uint8_t>* out, int64_t signedValue)
+{
+    uint64_t value = (uint64_t(signedValue) << 1) ^ uint64_t(signedValue >> 63);
+    while (value >= 0x80)
+    {
+        out->push_back(uint8_t(value) | 0x80);
+        value >>= 7;
+    }
+    out->push_back(uint8_t(value));
+}
+
+bool getVarint(const uint8_t** p, const uint8_t* end, int64_t* signedValue)
+{
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (*p == end)
+        {
+            return false;
+        }
+        const uint8_t byte = *(*p)++;
+        value |= uint64_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *signedValue = int64_t(value >> 1) ^ -int64_t(value & 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+}  // namespace
+
+void KeyframeIndex::finish()
+{
+    std::sort(m_entries.begin(), m_entries.end(), [](const Entry& left, const Entry& right)
+              {
+                  return left.pts < right.pts;
+              });
+    m_entries.erase(std::unique(m_entries.begin(), m_entries.end(),
+                                [](const Entry& left, const Entry& right)
+                                {
+                                    return left.pts == right.pts;
+                                }),
+                    m_entries.end());
+}
+
+bool KeyframeIndex::find(int64_t pts, Entry* entry) const
+{
+    auto it = std::upper_bound(m_entries.begin(), m_entries.end(), pts,
+                               [](int64_t value, const Entry& item)
+                               {
+                                   return value < item.pts;
+                               });
+    if (it == m_entries.begin())
+    {
+        return false;
+    }
+    *entry = *--it;
+    return true;
+}
+
+bool KeyframeIndex::findNearest(int64_t pts, Entry* entry) const
+{
+    auto it = std::lower_bound(m_entries.begin(), m_entries.end(), pts,
+                               [](const Entry& item, int64_t value)
+                               {
+                                   return item.pts < value;
+                               });
+    if (it == m_entries.end())
+    {
+        if (m_entries.empty())
+        {
+            return false;
+        }
+        --it;
+    }
+    else if (it != m_entries.begin() && pts - (it - 1)->pts < it->pts - pts)
+    {
+        --it;
+    }
+    *entry = *it;
+    return true;
+}
+
+bool KeyframeIndex::load(const PathType& sidecar, const FileStamp& stamp, int streamIndex)
+{
+    std::ifstream s(sidecar.c_str(), std::ios::binary);
+    if (!s)
+    {
+        return false;
+    }
+    const std::vector<uint8_t> data((std::istreambuf_iterator<char>(s)),
+                                    std::istreambuf_iterator<char>());
+
+    const uint8_t* p = data.data();
+    const uint8_t* const end = p + data.size();
+
+    uint64_t version, size, mtime, stream, count;
+    if (end - p < (int)sizeof(MAGIC) || memcmp(p, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        return false;
+    }
+    p += sizeof(MAGIC);
+    if (!getFixed(&p, end, 4, &version) || version != VERSION || !getFixed(&p, end, 8, &size) ||
+        !getFixed(&p, end, 8, &mtime) || !getFixed(&p, end, 4, &stream) ||
+        !getFixed(&p, end, 4, &count))
+    {
+        return false;
+    }
+    if (int64_t(size) != stamp.size || int64_t(mtime) != stamp.mtime ||
+        int(stream) != streamIndex || count > uint64_t(end - p) / 2)
+    {
+        return false;  // stale, or not ours
+    }
+
+    std::vector<Entry> entries;
+    entries.reserve((size_t)count);
+    Entry entry = {0, 0};
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        int64_t ptsDelta, posDelta;
+        if (!getVarint(&p, end, &ptsDelta) || !getVarint(&p, end, &posDelta))
+        {
+            return false;
+        }
+        entry.pts += ptsDelta;
+        entry.pos += posDelta;
+        entries.push_back(entry);
+    }
+
+    m_entries.swap(entries);
+    return true;
+}
+
+bool KeyframeIndex::save(const PathType& sidecar, const FileStamp& stamp, int streamIndex) const
+{
+    std::vector<uint8_t> data(MAGIC, MAGIC + sizeof(MAGIC));
+    putFixed(&data, VERSION, 4);
+    putFixed(&data, stamp.size, 8);
+    putFixed(&data, stamp.mtime, 8);
+    putFixed(&data, streamIndex, 4);
+    putFixed(&data, m_entries.size(), 4);
+
+    Entry previous = {0, 0};
+    for (const Entry& entry : m_entries)
+    {
+        putVarint(&data, entry.pts - previous.pts);
+        putVarint(&data, entry.pos - previous.pos);
+        previous = entry;
+    }
+
+    std::ofstream s(sidecar.c_str(), std::ios::binary | std::ios::trunc);
+    s.write((const char*)data.data(), data.size());
+    return bool(s);
+}
+
+PathType KeyframeIndex::sidecarPath(const PathType& mediaFile)
+{
+#ifdef _WIN32
+    return mediaFile + L".kfidx";
+#else
+    return mediaFile + ".kfidx";
+#endif
+}
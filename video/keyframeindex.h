@@ -0,0 +1,38 @@
+#pragma once
+
+#include "filestamp.h"
+
+#include <vector>
+
+// Keyframe positions of one stream (pts -> byte offset), for containers that
+// carry no usable index of their own. Persisted next to the media file as a
+// small sidecar that stays valid while the file's size and mtime are unchanged.
+class KeyframeIndex
+{
+   public:
+    struct Entry
+    {
+        int64_t pts;
+        int64_t pos;
+    };
+
+    // Entries may come in any order; call finish() when done adding.
+    void add(int64_t pts, int64_t pos) { m_entries.push_back({pts, pos}); }
+    void finish();
+
+    bool empty() const { return m_entries.empty(); }
+    size_t size() const { return m_entries.size(); }
+
+    // Finds the last keyframe at or before pts; false if pts precedes all of them.
+    bool find(int64_t pts, Entry* entry) const;
+    // Finds the keyframe closest to pts on either side; false if the index is empty.
+    bool findNearest(int64_t pts, Entry* entry) const;
+
+    bool load(const PathType& sidecar, const FileStamp& stamp, int streamIndex);
+    bool save(const PathType& sidecar, const FileStamp& stamp, int streamIndex) const;
+
+    static PathType sidecarPath(const PathType& mediaFile);
+
+   private:
+    std::vector<Entry> m_entries;
+};
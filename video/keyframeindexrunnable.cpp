@@ -0,0 +1,55 @@
+#include "keyframeindexrunnable.h"
+#include "keyframeindex.h"
+
+bool KeyframeIndexRunnable::isIndexedStream(int streamIndex) const
+{
+    const AVStream* stream = m_formatContext->streams[streamIndex];
+    // Demuxers that don't set ids leave them all 0; their streams come in header order
+    return stream->id == m_streamId && stream->codec->codec_type == m_codecType &&
+           (m_streamId != 0 || streamIndex == m_streamIndex);
+}
+
+void KeyframeIndexRunnable::operator()()
+{
+    CHANNEL_LOG(ffmpeg_threads) << "Keyframe indexing thread started";
+    TraceRecorder::instance().setThreadName("index");
+    TRACE_SPAN("build keyframe index");
+
+    auto index = std::make_shared<KeyframeIndex>();
+
+    AVPacket packet;
+    while (av_read_frame(m_formatContext.get(), &packet) >= 0)
+    {
+        if ((packet.flags & AV_PKT_FLAG_KEY) && packet.pos >= 0 &&
+            isIndexedStream(packet.stream_index))
+        {
+            const int64_t pts = (packet.pts != AV_NOPTS_VALUE) ? packet.pts : packet.dts;
+            if (pts != AV_NOPTS_VALUE)
+            {
+                index->add(pts, packet.pos);
+            }
+        }
+        av_free_packet(&packet);
+
+        if (boost::this_thread::interruption_requested())
+        {
+            CHANNEL_LOG(ffmpeg_threads) << "Keyframe indexing broken";
+            return;
+        }
+    }
+
+    index->finish();
+    if (index->empty())
+    {
+        CHANNEL_LOG(ffmpeg_seek) << "No keyframes to index";
+        return;
+    }
+
+    CHANNEL_LOG(ffmpeg_seek) << "Keyframe index built, " << index->size() << " entries";
+    m_ffmpeg->setKeyframeIndex(index);
+
+    if (!index->save(m_sidecar, m_stamp, m_streamIndex))
+    {
+        CHANNEL_LOG(ffmpeg_seek) << "Couldn't save the keyframe index";
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "ffmpegdecoder.h"
+#include "filestamp.h"
+
+// Builds a keyframe index with a second demuxer over the same file while the
+// file plays, then hands it to the decoder for seeking and saves the sidecar.
+//
+// The second demuxer skips stream analysis, so containers that add streams as they
+// come (MPEG-TS) may number them differently; the stream is told by its id and type.
+class KeyframeIndexRunnable
+{
+	FFmpegDecoder* m_ffmpeg;
+	std::shared_ptr<AVFormatContext> m_formatContext;
+	int m_streamIndex;  // in playback's demuxer
+	int m_streamId;
+	AVMediaType m_codecType;
+	PathType m_sidecar;
+	FileStamp m_stamp;
+
+public:
+	// Takes ownership of formatContext
+	KeyframeIndexRunnable(FFmpegDecoder* parent, AVFormatContext* formatContext,
+						  const AVStream* stream, const PathType& sidecar, const FileStamp& stamp)
+		: m_ffmpeg(parent),
+		m_formatContext(formatContext, [](AVFormatContext* context) { FFmpegDecoder::closeInput(&context); }),
+		m_streamIndex(stream->index),
+		m_streamId(stream->id),
+		m_codecType(stream->codec->codec_type),
+		m_sidecar(sidecar),
+		m_stamp(stamp)
+	{}
+	void operator()();
+
+private:
+	bool isIndexedStream(int streamIndex) const;
+};
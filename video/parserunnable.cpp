@@ -1,10 +1,34 @@
 #include "parserunnable.h"
+#include "convertrunnable.h"
 #include "videoparserunnable.h"
 #include "audioparserunnable.h"
+#include "audiooutputrunnable.h"
+#include "keyframeindex.h"
 #include "makeguard.h"
 
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+
+enum
+{
+    TAIL_SCAN_SIZE = 256 * 1024,
+    TAIL_SCAN_RETRIES = 6,  // the last attempt reads 8 MB
+    MIN_PROJECTION_SPAN = 1024 * 1024,
+};
+
+int64_t packetTimestamp(const AVPacket& packet)
+{
+    return (packet.pts != AV_NOPTS_VALUE) ? packet.pts : packet.dts;
+}
+
+}  // namespace
+
 bool ParseRunnable::readFrame(AVPacket* packet)
 {
+    TRACE_SPAN("read packet");
     int ret = av_read_frame(m_ffmpeg->m_formatContext, packet);
     if (ret >= 0)
     {
@@ -20,6 +44,7 @@ bool ParseRunnable::readFrame(AVPacket* packet)
 void ParseRunnable::operator()()
 {
     CHANNEL_LOG(ffmpeg_threads) << "Parse thread started";
+    TraceRecorder::instance().setThreadName("parse");
     AVPacket packet;
     bool eof = false;
 
@@ -39,8 +64,22 @@ void ParseRunnable::operator()()
         // seeking
         sendSeekPacket();
 
+        if (m_scrubKeyframeSent)
+        {
+            // Nothing more to show for this scrub position; wait for the next one
+            m_ffmpeg->m_videoPacketsQueue.waitProducer([this]()
+                                                       {
+                                                           return m_ffmpeg->m_seekDuration >= 0;
+                                                       });
+            continue;
+        }
+
+        m_ffmpeg->m_videoPacketsQueue.flushParked();
+        m_ffmpeg->m_audioPacketsQueue.flushParked();
+
         if (readFrame(&packet))
         {
+            refineDuration(packet);
             dispatchPacket(packet);
 
             eof = false;
@@ -49,12 +88,12 @@ void ParseRunnable::operator()()
         {
             if (eof)
             {
-                const bool videoPacketsQueueIsEmpty =
-                    m_ffmpeg->m_videoPacketsQueue.size(m_ffmpeg->m_packetsQueueMutex) == 0;
-                const bool audioPacketsQueueIsEmpty =
-                    m_ffmpeg->m_audioPacketsQueue.size(m_ffmpeg->m_packetsQueueMutex) == 0;
-                if (videoPacketsQueueIsEmpty && audioPacketsQueueIsEmpty &&
-                    m_ffmpeg->m_videoFramesQueue.m_busy == 0)
+                if (m_ffmpeg->m_videoPacketsQueue.empty() && m_ffmpeg->m_audioPacketsQueue.empty() &&
+                    !m_ffmpeg->m_videoPacketsQueue.hasParked() &&
+                    !m_ffmpeg->m_audioPacketsQueue.hasParked() &&
+                    m_ffmpeg->m_videoDrainGeneration !=
+                        int(m_ffmpeg->m_videoPacketsQueue.generation()) &&
+                    m_ffmpeg->m_audioRing.filledBytes() == 0 && videoFramesDone())
                 {
                     if (m_ffmpeg->m_decoderListener)
                         m_ffmpeg->m_decoderListener->onEndOfStream();
@@ -62,7 +101,18 @@ void ParseRunnable::operator()()
 
                 boost::this_thread::sleep_for(boost::chrono::milliseconds(10));
             }
+            else if (reader_eof)
+            {
+                queueDrainPacket();
+            }
             eof = reader_eof;
+
+            if (reader_eof && m_refineDuration && m_lastPts != AV_NOPTS_VALUE)
+            {
+                // Everything up to the end has been demuxed, so the duration is exact now
+                setDuration(m_lastPts);
+                m_refineDuration = false;
+            }
         }
 
         // Continue packet reading
@@ -80,39 +130,40 @@ void ParseRunnable::dispatchPacket(AVPacket& packet)
         return; // guard frees packet
     }
 
+    if (m_scrubSeek)
+    {
+        // Scrubbing: audio stays muted and the video decoder gets a single keyframe
+        if (packet.stream_index != m_ffmpeg->m_videoStreamNumber ||
+            !(packet.flags & AV_PKT_FLAG_KEY) || m_scrubKeyframeSent)
+        {
+            return; // guard frees packet
+        }
+        m_scrubKeyframeSent = true;
+    }
+
     if (packet.stream_index == m_ffmpeg->m_videoStreamNumber)
     { 
+        TRACE_SPAN("enqueue video packet");
+        const double duration =
+            packetDuration(packet, m_ffmpeg->m_videoStream, &m_lastVideoDts, &m_lastVideoDtsGap);
+        if (!enqueuePacket(m_ffmpeg->m_videoPacketsQueue, m_ffmpeg->m_audioPacketsQueue,
+                           m_ffmpeg->m_audioStreamNumber >= 0, packet, duration,
+                           &m_overfillingVideo, m_ffmpeg->m_statistics.audioStarvations))
         {
-            boost::unique_lock<boost::mutex> locker(m_ffmpeg->m_packetsQueueMutex);
-            while (m_ffmpeg->m_videoPacketsQueue.packetsSize() >= MAX_QUEUE_SIZE ||
-                m_ffmpeg->m_videoPacketsQueue.size() >= MAX_VIDEO_FRAMES)
-            {
-                if (m_ffmpeg->m_seekDuration >= 0)
-                {
-                    return; // guard frees packet
-                }
-                m_ffmpeg->m_packetsQueueCV.wait(locker);
-            }
-            m_ffmpeg->m_videoPacketsQueue.enqueue(packet);
+            return; // guard frees packet
         }
-        m_ffmpeg->m_packetsQueueCV.notify_all();
     }
     else if (packet.stream_index == m_ffmpeg->m_audioStreamNumber)
     { 
+        TRACE_SPAN("enqueue audio packet");
+        const double duration =
+            packetDuration(packet, m_ffmpeg->m_audioStream, &m_lastAudioDts, &m_lastAudioDtsGap);
+        if (!enqueuePacket(m_ffmpeg->m_audioPacketsQueue, m_ffmpeg->m_videoPacketsQueue,
+                           m_ffmpeg->m_videoStreamNumber >= 0, packet, duration,
+                           &m_overfillingAudio, m_ffmpeg->m_statistics.videoStarvations))
         {
-            boost::unique_lock<boost::mutex> locker(m_ffmpeg->m_packetsQueueMutex);
-            while (m_ffmpeg->m_audioPacketsQueue.packetsSize() >= MAX_QUEUE_SIZE ||
-                m_ffmpeg->m_audioPacketsQueue.size() >= MAX_AUDIO_FRAMES)
-            {
-                if (m_ffmpeg->m_seekDuration >= 0)
-                {
-                    return; // guard frees packet
-                }
-                m_ffmpeg->m_packetsQueueCV.wait(locker);
-            }
-            m_ffmpeg->m_audioPacketsQueue.enqueue(packet);
+            return; // guard frees packet
         }
-        m_ffmpeg->m_packetsQueueCV.notify_all();
     }
     else
     {
@@ -134,11 +185,134 @@ void ParseRunnable::dispatchPacket(AVPacket& packet)
     guard.release();
 }
 
+// Nothing left in the conversion stage or waiting to be displayed
+bool ParseRunnable::videoFramesDone() const
+{
+    boost::lock_guard<boost::mutex> locker(m_ffmpeg->m_videoFramesMutex);
+    const VQueue& frames = m_ffmpeg->m_videoFramesQueue;
+    return frames.m_busy == 0 && frames.m_converting == 0 && m_ffmpeg->m_conversionJobs.empty();
+}
+
+// Frame threads and reordering keep the last frames in the video decoder until it gets
+// an empty packet; the video thread decodes that one until nothing more comes out.
+void ParseRunnable::queueDrainPacket()
+{
+    if (m_ffmpeg->m_videoStreamNumber < 0)
+    {
+        return;
+    }
+
+    AVPacket packet;
+    av_init_packet(&packet);
+    packet.data = nullptr;
+    packet.size = 0;
+
+    FQueue& queue = m_ffmpeg->m_videoPacketsQueue;
+    m_ffmpeg->m_videoDrainGeneration = int(queue.generation());
+    if (queue.hasParked() || !queue.push(packet, 0))
+    {
+        queue.park(packet, 0);
+    }
+}
+
+// Waits until the queue wants more; false if a seek request came in meanwhile.
+//
+// The demuxer must not sit on a full queue while the other stream runs dry, as
+// happens with badly interleaved files. Then the full queue takes packets beyond
+// its target, and beyond its ring capacity by parking them, within hard limits.
+bool ParseRunnable::enqueuePacket(FQueue& queue, const FQueue& other, bool hasOther,
+                                  const AVPacket& packet, double duration, bool* overfilling,
+                                  boost::atomic<uint64_t>& otherStarvations)
+{
+    auto mayOverfill = [&queue, &other, hasOther]()
+    {
+        return hasOther && other.starving() &&
+               queue.pendingSecs() < queue.targetSecs() * MAX_OVERFILL_FACTOR &&
+               queue.pendingSize() < MAX_PACKET_QUEUE_BYTES;
+    };
+
+    queue.flushParked();
+    queue.waitProducer([this, &queue, &mayOverfill]()
+                       {
+                           return m_ffmpeg->m_seekDuration >= 0 || !queue.full() ||
+                                  mayOverfill();
+                       });
+    if (m_ffmpeg->m_seekDuration >= 0)
+    {
+        return false;
+    }
+
+    queue.flushParked();
+
+    if (!queue.full())
+    {
+        *overfilling = false;
+    }
+    else
+    {
+        if (!*overfilling)
+        {
+            *overfilling = true;
+            ++otherStarvations;
+            CHANNEL_LOG(ffmpeg_readpacket) << "Stream starving, overfilling the other queue";
+        }
+        ++m_ffmpeg->m_statistics.overfilledPackets;
+    }
+
+    if (queue.hasParked() || !queue.push(packet, duration))
+    {
+        queue.park(packet, duration);
+        ++m_ffmpeg->m_statistics.parkedPackets;
+    }
+    return true;
+}
+
+// Playing time of a packet, guessed from the stream parameters when the container
+// doesn't tell. The dts gap to the previous packet is that packet's duration, so it
+// only stands in for this one's when the stream parameters don't say either.
+double ParseRunnable::packetDuration(const AVPacket& packet, const AVStream* stream,
+                                     int64_t* lastDts, double* lastDtsGap)
+{
+    const AVCodecContext* codec = stream->codec;
+    const double timeBase = av_q2d(stream->time_base);
+
+    double duration = 0;
+    if (packet.duration > 0)
+    {
+        duration = packet.duration * timeBase;
+    }
+    else if (codec->codec_type == AVMEDIA_TYPE_VIDEO && stream->avg_frame_rate.num > 0)
+    {
+        duration = 1. / av_q2d(stream->avg_frame_rate);
+    }
+    else if (codec->codec_type == AVMEDIA_TYPE_AUDIO && codec->frame_size > 0 &&
+             codec->sample_rate > 0)
+    {
+        duration = double(codec->frame_size) / codec->sample_rate;
+    }
+    else
+    {
+        duration = *lastDtsGap;
+    }
+
+    if (packet.dts != AV_NOPTS_VALUE)
+    {
+        // A gap across a discontinuity says nothing about packet durations
+        const double gap = (*lastDts != AV_NOPTS_VALUE) ? (packet.dts - *lastDts) * timeBase : 0;
+        *lastDtsGap = (gap > 0 && gap < 1.) ? gap : 0;
+        *lastDts = packet.dts;
+    }
+
+    // Timestamp discontinuities mustn't make one packet fill the whole buffer
+    return std::min(duration, 1.);
+}
+
 void ParseRunnable::startAudioThread(FFmpegDecoder* m_ffmpeg)
 {
     if (m_ffmpeg->m_audioStreamNumber >= 0)
     {
         m_ffmpeg->m_mainAudioThread.reset(new boost::thread(AudioParseRunnable(m_ffmpeg)));
+        m_ffmpeg->m_audioOutputThread.reset(new boost::thread(AudioOutputRunnable(m_ffmpeg)));
     }
 }
 
@@ -147,6 +321,7 @@ void ParseRunnable::startVideoThread(FFmpegDecoder* m_ffmpeg)
     if (m_ffmpeg->m_videoStreamNumber >= 0)
     {
         m_ffmpeg->m_mainVideoThread.reset(new boost::thread(VideoParseRunnable(m_ffmpeg)));
+        m_ffmpeg->m_mainConvertThread.reset(new boost::thread(ConvertRunnable(m_ffmpeg)));
     }
 }
 
@@ -158,101 +333,248 @@ void ParseRunnable::sendSeekPacket()
         return;
     }
 
-    if (avformat_seek_file(m_ffmpeg->m_formatContext, m_ffmpeg->m_videoStreamNumber, 0,
-                           seekDuration, seekDuration, AVSEEK_FLAG_FRAME) < 0)
+    TRACE_SPAN("seek");
+
+    const bool scrub = m_ffmpeg->m_scrubbing;
+    const bool exactOnce = m_ffmpeg->m_exactSeekOnce.exchange(false);
+    const bool exact = !scrub && (exactOnce || m_ffmpeg->m_exactSeek);
+
+    // Scrubbing takes whichever keyframe is closer, other seeks the one before the target
+    const int64_t maxTs = scrub ? std::numeric_limits<int64_t>::max() : seekDuration;
+    if (!seekByKeyframeIndex(seekDuration, scrub) &&
+        avformat_seek_file(m_ffmpeg->m_formatContext, m_ffmpeg->m_videoStreamNumber, 0,
+                           seekDuration, maxTs, AVSEEK_FLAG_FRAME) < 0)
     {
         CHANNEL_LOG(ffmpeg_seek) << "Seek failed";
         return;
     }
 
-    const bool hasVideo = m_ffmpeg->m_mainVideoThread != 0;
-    const bool hasAudio = m_ffmpeg->m_mainAudioThread != 0;
+    m_lastPts = AV_NOPTS_VALUE;
+    m_lastVideoDts = AV_NOPTS_VALUE;
+    m_lastAudioDts = AV_NOPTS_VALUE;
+    m_lastVideoDtsGap = 0;
+    m_lastAudioDtsGap = 0;
+    m_overfillingVideo = false;
+    m_overfillingAudio = false;
+    m_scrubSeek = scrub && m_ffmpeg->m_videoStream;
+    m_scrubKeyframeSent = false;
+
+    // Published before the new generation, which the decoder threads pick them up with
+    m_ffmpeg->m_seekTarget = (exact && m_ffmpeg->m_videoStream) ? seekDuration : AV_NOPTS_VALUE;
+    m_ffmpeg->m_scrubSeek = m_scrubSeek;
+
+    // The decoder threads keep running: they discard what is still queued, flush
+    // their codecs and reset their clocks once they pop a packet of the new generation
+    m_ffmpeg->m_videoPacketsQueue.startGeneration();
+    m_ffmpeg->m_audioPacketsQueue.startGeneration();
 
-    if (hasVideo)
+    // Wake a video thread waiting for a frame slot with a stale frame
     {
-        m_ffmpeg->m_mainVideoThread->interrupt();
+        boost::lock_guard<boost::mutex> locker(m_ffmpeg->m_videoFramesMutex);
+        m_ffmpeg->m_videoFramesCV.notify_all();
     }
-    if (hasAudio)
+
+    // While paused, let the decoder threads through to show the new position
     {
-        m_ffmpeg->m_mainAudioThread->interrupt();
+        boost::lock_guard<boost::mutex> locker(m_ffmpeg->m_isPausedMutex);
+        m_ffmpeg->seekWhilePaused();
+        m_ffmpeg->m_isPausedCV.notify_all();
     }
+}
 
-    if (hasVideo)
+bool ParseRunnable::seekByKeyframeIndex(int64_t seekDuration, bool nearest)
+{
+    const auto index = m_ffmpeg->keyframeIndex();
+    KeyframeIndex::Entry entry;
+    if (!index ||
+        !(nearest ? index->findNearest(seekDuration, &entry) : index->find(seekDuration, &entry)))
     {
-        m_ffmpeg->m_mainVideoThread->join();
+        return false;
     }
-    if (hasAudio)
+
+    if (avformat_seek_file(m_ffmpeg->m_formatContext, -1, std::numeric_limits<int64_t>::min(),
+                           entry.pos, std::numeric_limits<int64_t>::max(), AVSEEK_FLAG_BYTE) < 0)
     {
-        m_ffmpeg->m_mainAudioThread->join();
+        CHANNEL_LOG(ffmpeg_seek) << "Seek by keyframe index failed";
+        return false;
     }
 
-    // Reset stuff
-    m_ffmpeg->m_videoPacketsQueue.clear();
-    m_ffmpeg->m_audioPacketsQueue.clear();
+    CHANNEL_LOG(ffmpeg_seek) << "Seek by keyframe index to " << entry.pts << " at byte " << entry.pos;
+    return true;
+}
 
-    const auto currentTime = GetHiResTime();
-    if (hasVideo)
+void ParseRunnable::fixDuration()
+{
+    if (m_ffmpeg->m_frameTotalCount > 0 || m_ffmpeg->m_duration > 0)
     {
-        if (m_ffmpeg->m_videoCodecContext)
-            avcodec_flush_buffers(m_ffmpeg->m_videoCodecContext);
-        m_ffmpeg->m_videoFramesQueue.setDisplayTime(currentTime);
+        return;
     }
-    if (hasAudio)
+
+    m_durationStreamNumber = (m_ffmpeg->m_videoStreamNumber >= 0) ? m_ffmpeg->m_videoStreamNumber
+                                                                  : m_ffmpeg->m_audioStreamNumber;
+    if (m_durationStreamNumber < 0)
     {
-        if (m_ffmpeg->m_audioCodecContext)
-            avcodec_flush_buffers(m_ffmpeg->m_audioCodecContext);
-        m_ffmpeg->m_audioPlayer->WaveOutReset();
+        return;
     }
 
-    m_ffmpeg->seekWhilePaused();
+    TRACE_SPAN("fix duration");
+
+    AVFormatContext* formatContext = m_ffmpeg->m_formatContext;
+    m_fileSize = formatContext->pb ? avio_size(formatContext->pb) : -1;
+    m_refineDuration = true;
 
-    // Restart
-    if (hasVideo)
+    // Reset rechecking vars
+    m_ffmpeg->m_frameTotalCount = 0;
+    m_ffmpeg->m_duration = 0;
+
+    int64_t lastPts = AV_NOPTS_VALUE;
+    if (scanTailForDuration(m_durationStreamNumber, &lastPts))
     {
-        m_ffmpeg->m_mainVideoThread.reset(new boost::thread(VideoParseRunnable(m_ffmpeg)));
+        CHANNEL_LOG(ffmpeg_opening) << "Duration taken from the file tail: " << lastPts;
+        setDuration(lastPts);
+        return;
     }
-    if (hasAudio)
+
+    if (boost::this_thread::interruption_requested())
     {
-        m_ffmpeg->m_mainAudioThread.reset(new boost::thread(AudioParseRunnable(m_ffmpeg)));
+        CHANNEL_LOG(ffmpeg_threads) << "Parse thread broken";
+        return;
+    }
+
+    // Fall back to the bitrate; refineDuration() corrects it once packets come in
+    m_projectDuration = m_fileSize > 0;
+
+    // The container's rate, or else all the streams' together
+    int64_t bitRate = formatContext->bit_rate;
+    if (bitRate <= 0)
+    {
+        bitRate = 0;
+        for (unsigned i = 0; i < formatContext->nb_streams; ++i)
+        {
+            bitRate += std::max<int64_t>(formatContext->streams[i]->codec->bit_rate, 0);
+        }
+    }
+    if (m_fileSize > 0 && bitRate > 0)
+    {
+        const AVStream* stream = formatContext->streams[m_durationStreamNumber];
+        const int64_t startTime = (stream->start_time != AV_NOPTS_VALUE) ? stream->start_time : 0;
+        const double secs = m_fileSize * 8. / bitRate;
+        CHANNEL_LOG(ffmpeg_opening) << "Duration estimated from the bitrate: " << secs << " s";
+        setDuration(startTime + int64_t(secs / av_q2d(stream->time_base)));
     }
 }
 
-void ParseRunnable::fixDuration()
+// Finds the last timestamp of the stream by demuxing only the end of the file.
+// Like FFmpeg's own estimate_timings_from_pts(), minus its fallback to a full scan.
+bool ParseRunnable::scanTailForDuration(int streamIndex, int64_t* lastPts)
 {
-    AVPacket packet;
-    if (m_ffmpeg->m_frameTotalCount <= 0 && m_ffmpeg->m_duration <= 0)
+    AVFormatContext* formatContext = m_ffmpeg->m_formatContext;
+    if (m_fileSize <= 0 || !formatContext->pb->seekable ||
+        (formatContext->iformat->flags & AVFMT_NO_BYTE_SEEK))
     {
-        // Reset rechecking vars
-        m_ffmpeg->m_frameTotalCount = 0;
-        m_ffmpeg->m_duration = 0;
-        while (av_read_frame(m_ffmpeg->m_formatContext, &packet) >= 0)
+        return false;
+    }
+
+    for (int retry = 0; retry < TAIL_SCAN_RETRIES && *lastPts == AV_NOPTS_VALUE; ++retry)
+    {
+        const int64_t offset =
+            std::max<int64_t>(0, m_fileSize - (int64_t(TAIL_SCAN_SIZE) << retry));
+        if (avformat_seek_file(formatContext, -1, std::numeric_limits<int64_t>::min(), offset,
+                               std::numeric_limits<int64_t>::max(), AVSEEK_FLAG_BYTE) < 0)
+        {
+            break;
+        }
+
+        AVPacket packet;
+        while (av_read_frame(formatContext, &packet) >= 0)
         {
-            if (packet.stream_index == m_ffmpeg->m_videoStreamNumber)
+            const int64_t timestamp = packetTimestamp(packet);
+            if (packet.stream_index == streamIndex && timestamp != AV_NOPTS_VALUE &&
+                (*lastPts == AV_NOPTS_VALUE || timestamp > *lastPts))
             {
-                ++m_ffmpeg->m_frameTotalCount;
-                if (packet.pts != AV_NOPTS_VALUE)
-                {
-                    m_ffmpeg->m_duration = packet.pts;
-                }
-                else if (packet.dts != AV_NOPTS_VALUE)
-                {
-                    m_ffmpeg->m_duration = packet.dts;
-                }
+                *lastPts = timestamp;
             }
             av_free_packet(&packet);
 
             if (boost::this_thread::interruption_requested())
             {
-                CHANNEL_LOG(ffmpeg_threads) << "Parse thread broken";
-                return;
+                return false;
             }
         }
 
-        if (avformat_seek_file(m_ffmpeg->m_formatContext, m_ffmpeg->m_videoStreamNumber, 0, 0, 0,
-                               AVSEEK_FLAG_FRAME) < 0)
+        if (offset == 0)
         {
-            CHANNEL_LOG(ffmpeg_seek) << "Seek failed";
-            return;
+            break;
         }
     }
+
+    // Rewind for playback
+    if (avformat_seek_file(formatContext, -1, std::numeric_limits<int64_t>::min(), 0,
+                           std::numeric_limits<int64_t>::max(), AVSEEK_FLAG_BYTE) < 0)
+    {
+        CHANNEL_LOG(ffmpeg_seek) << "Seek failed";
+    }
+
+    return *lastPts != AV_NOPTS_VALUE;
+}
+
+// Runs on every demuxed packet while playing, so refining costs no extra I/O
+void ParseRunnable::refineDuration(const AVPacket& packet)
+{
+    if (!m_refineDuration || packet.stream_index != m_durationStreamNumber)
+    {
+        return;
+    }
+
+    const int64_t timestamp = packetTimestamp(packet);
+    if (timestamp == AV_NOPTS_VALUE)
+    {
+        return;
+    }
+
+    if (m_lastPts == AV_NOPTS_VALUE || timestamp > m_lastPts)
+    {
+        m_lastPts = timestamp;
+    }
+
+    int64_t duration = m_ffmpeg->m_duration;
+
+    if (m_projectDuration && packet.pos >= 0)
+    {
+        if (m_refinePos < 0 || packet.pos < m_refinePos)
+        {
+            m_refinePos = packet.pos;
+            m_refinePts = timestamp;
+        }
+        else if (packet.pos - m_refinePos >= MIN_PROJECTION_SPAN && timestamp > m_refinePts)
+        {
+            // Extrapolate the rate measured so far over the rest of the file
+            duration = timestamp + int64_t(double(m_fileSize - packet.pos) *
+                                           (timestamp - m_refinePts) / (packet.pos - m_refinePos));
+        }
+    }
+
+    setDuration(std::max(duration, m_lastPts));
+}
+
+void ParseRunnable::setDuration(int64_t duration)
+{
+    if (duration == m_ffmpeg->m_duration)
+    {
+        return;
+    }
+
+    m_ffmpeg->m_duration = duration;
+
+    if (m_durationStreamNumber == m_ffmpeg->m_videoStreamNumber && duration > 0)
+    {
+        const AVStream* stream = m_ffmpeg->m_videoStream;
+        const int64_t startTime = (stream->start_time != AV_NOPTS_VALUE) ? stream->start_time : 0;
+        m_ffmpeg->m_frameTotalCount = int64_t(av_q2d(stream->time_base) * (duration - startTime) *
+                                              av_q2d(stream->avg_frame_rate));
+    }
+    else
+    {
+        m_ffmpeg->m_frameTotalCount = 0;
+    }
 }
@@ -8,16 +8,66 @@ class ParseRunnable
 
 	bool reader_eof;
 
+	// Set while m_duration is only an estimate and gets refined from demuxed packets
+	bool m_refineDuration;
+	// Set if the tail scan failed and the estimate is extrapolated from the byte position
+	bool m_projectDuration;
+	int m_durationStreamNumber;
+	int64_t m_fileSize;
+	int64_t m_refinePos;
+	int64_t m_refinePts;
+	int64_t m_lastPts;
+
+	// Per stream, for guessing missing packet durations; reset with every seek
+	int64_t m_lastVideoDts;
+	int64_t m_lastAudioDts;
+	double m_lastVideoDtsGap;  // seconds between the last two packets, 0 if unknown
+	double m_lastAudioDtsGap;
+
+	// Set while a queue takes packets beyond its limits for the other, starving one
+	bool m_overfillingVideo;
+	bool m_overfillingAudio;
+
+	// After a scrub seek only one video keyframe goes out, then reading stops
+	bool m_scrubSeek;
+	bool m_scrubKeyframeSent;
+
 	bool readFrame(AVPacket* packet);
 	void sendSeekPacket();
+	bool seekByKeyframeIndex(int64_t seekDuration, bool nearest);
 	void fixDuration();
+	bool scanTailForDuration(int streamIndex, int64_t* lastPts);
+	void refineDuration(const AVPacket& packet);
+	void setDuration(int64_t duration);
 
     void dispatchPacket(AVPacket& packet);
+    bool videoFramesDone() const;
+    void queueDrainPacket();
+    bool enqueuePacket(FQueue& queue, const FQueue& other, bool hasOther, const AVPacket& packet,
+                       double duration, bool* overfilling,
+                       boost::atomic<uint64_t>& otherStarvations);
+    double packetDuration(const AVPacket& packet, const AVStream* stream, int64_t* lastDts,
+                          double* lastDtsGap);
 
 public:
 	explicit ParseRunnable(FFmpegDecoder* parent) :
 		m_ffmpeg(parent),
-		reader_eof(false)
+		reader_eof(false),
+		m_refineDuration(false),
+		m_projectDuration(false),
+		m_durationStreamNumber(-1),
+		m_fileSize(-1),
+		m_refinePos(-1),
+		m_refinePts(AV_NOPTS_VALUE),
+		m_lastPts(AV_NOPTS_VALUE),
+		m_lastVideoDts(AV_NOPTS_VALUE),
+		m_lastAudioDts(AV_NOPTS_VALUE),
+		m_lastVideoDtsGap(0),
+		m_lastAudioDtsGap(0),
+		m_overfillingVideo(false),
+		m_overfillingAudio(false),
+		m_scrubSeek(false),
+		m_scrubKeyframeSent(false)
 	{}
 	void operator() ();
 
@@ -0,0 +1,195 @@
+#pragma once
+
+#include <boost/atomic.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+// Bounded single-producer/single-consumer ring of PCM bytes: the audio decoder thread
+// writes resampled audio, the audio output thread reads it for the device. Reads and
+// writes are lock-free copies of whole sample frames, and so is filledBytes(), which
+// anybody may call at any time. A side that has to block waits as on an FQueue, on a
+// condition variable signalled only while somebody is actually waiting there.
+//
+// A seek drops what was written without stopping the consumer: the producer marks its
+// write position, and the consumer skips up to the mark on its next read.
+class PcmRing
+{
+public:
+	PcmRing()
+		: m_frameBytes(1),
+		m_readPos(0),
+		m_writePos(0),
+		m_discardPos(0),
+		m_producerWaiting(false),
+		m_consumerWaiting(false)
+	{}
+
+	PcmRing(const PcmRing&) = delete;
+	PcmRing& operator=(const PcmRing&) = delete;
+
+	// Sizes the ring to whole frames and empties it. Only while both sides are stopped.
+	void open(int64_t capacity, int frameBytes)
+	{
+		m_frameBytes = std::max(1, frameBytes);
+		m_buffer.assign(size_t(std::max<int64_t>(capacity / m_frameBytes, 1) * m_frameBytes), 0);
+		m_readPos = 0;
+		m_writePos = 0;
+		m_discardPos = 0;
+	}
+
+	int64_t capacity() const { return int64_t(m_buffer.size()); }
+	int frameBytes() const { return m_frameBytes; }
+
+	// Producer side: copies as many whole frames of data as there is room for; returns
+	// the bytes taken.
+	int64_t write(const uint8_t* data, int64_t size)
+	{
+		const uint64_t writePos = m_writePos.load(boost::memory_order_relaxed);
+		const int64_t room = capacity() -
+			int64_t(writePos - m_readPos.load(boost::memory_order_acquire));
+		size = std::min(size, room) / m_frameBytes * m_frameBytes;
+		if (size <= 0)
+		{
+			return 0;
+		}
+
+		const size_t offset = size_t(writePos % m_buffer.size());
+		const size_t first = std::min(size_t(size), m_buffer.size() - offset);
+		memcpy(&m_buffer[offset], data, first);
+		memcpy(&m_buffer[0], data + first, size_t(size) - first);
+		m_writePos.store(writePos + size, boost::memory_order_release);
+
+		wake(m_consumerWaiting, m_consumerCV);
+		return size;
+	}
+
+	// Producer side: room for at least a frame
+	bool writable() const
+	{
+		return int64_t(m_writePos.load(boost::memory_order_relaxed) -
+			m_readPos.load(boost::memory_order_acquire)) < capacity();
+	}
+
+	// Producer side: drops everything written so far. The room it took comes free once
+	// the consumer has skipped it, on its next read or skipDiscarded().
+	void discard()
+	{
+		m_discardPos.store(m_writePos.load(boost::memory_order_relaxed),
+			boost::memory_order_release);
+	}
+
+	// Consumer side: copies up to size bytes, in whole frames; returns the bytes read.
+	int64_t read(uint8_t* data, int64_t size)
+	{
+		// The discard mark is never past the write position it was taken from
+		const uint64_t readPos = std::max(m_readPos.load(boost::memory_order_relaxed),
+			m_discardPos.load(boost::memory_order_acquire));
+		const uint64_t writePos = m_writePos.load(boost::memory_order_acquire);
+		size = std::min(size, int64_t(writePos - readPos)) / m_frameBytes * m_frameBytes;
+		if (size > 0)
+		{
+			const size_t offset = size_t(readPos % m_buffer.size());
+			const size_t first = std::min(size_t(size), m_buffer.size() - offset);
+			memcpy(data, &m_buffer[offset], first);
+			memcpy(data + first, &m_buffer[0], size_t(size) - first);
+		}
+		else
+		{
+			size = 0;
+		}
+		m_readPos.store(readPos + size, boost::memory_order_release);
+
+		wake(m_producerWaiting, m_producerCV);
+		return size;
+	}
+
+	// Consumer side
+	void skipDiscarded() { read(nullptr, 0); }
+
+	// Written and neither read nor discarded yet
+	int64_t filledBytes() const
+	{
+		const uint64_t readPos = std::max(m_readPos.load(boost::memory_order_acquire),
+			m_discardPos.load(boost::memory_order_acquire));
+		return int64_t(m_writePos.load(boost::memory_order_acquire) - readPos);
+	}
+
+	// Block the producer (consumer) until ready() holds. ready() is re-evaluated
+	// after every read (write) and on notifyAll(). These are boost interruption points.
+	template <typename Predicate>
+	void waitProducer(Predicate ready) { wait(m_producerWaiting, m_producerCV, ready); }
+
+	template <typename Predicate>
+	void waitConsumer(Predicate ready) { wait(m_consumerWaiting, m_consumerCV, ready); }
+
+	// Makes both sides re-check their conditions, e.g. after a pause request.
+	void notifyAll()
+	{
+		boost::lock_guard<boost::mutex> locker(m_mutex);
+		m_producerCV.notify_all();
+		m_consumerCV.notify_all();
+	}
+
+private:
+	enum { CACHE_LINE_SIZE = 64 };
+
+	void wake(boost::atomic_bool& waiting, boost::condition_variable& cv)
+	{
+		// Pairs with the fence in wait(): either the waiter sees our position update,
+		// or we see its flag.
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		if (waiting.load(boost::memory_order_relaxed))
+		{
+			boost::lock_guard<boost::mutex> locker(m_mutex);
+			cv.notify_one();
+		}
+	}
+
+	template <typename Predicate>
+	void wait(boost::atomic_bool& waiting, boost::condition_variable& cv, Predicate ready)
+	{
+		if (ready())
+		{
+			return;
+		}
+
+		boost::unique_lock<boost::mutex> locker(m_mutex);
+		waiting.store(true, boost::memory_order_relaxed);
+		boost::atomic_thread_fence(boost::memory_order_seq_cst);
+		try
+		{
+			while (!ready())
+			{
+				cv.wait(locker);
+			}
+		}
+		catch (...)
+		{
+			waiting.store(false, boost::memory_order_relaxed);
+			throw;
+		}
+		waiting.store(false, boost::memory_order_relaxed);
+	}
+
+	std::vector<uint8_t> m_buffer;
+	int m_frameBytes;
+
+	// Byte positions run freely, the offsets into the buffer being their remainders;
+	// the read and write positions sit on separate cache lines
+	char m_pad0[CACHE_LINE_SIZE];
+	boost::atomic<uint64_t> m_readPos;
+	char m_pad1[CACHE_LINE_SIZE];
+	boost::atomic<uint64_t> m_writePos;
+	char m_pad2[CACHE_LINE_SIZE];
+	boost::atomic<uint64_t> m_discardPos;
+
+	boost::mutex m_mutex;
+	boost::condition_variable m_producerCV;
+	boost::condition_variable m_consumerCV;
+	boost::atomic_bool m_producerWaiting;
+	boost::atomic_bool m_consumerWaiting;
+};
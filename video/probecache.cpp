@@ -0,0 +1,177 @@
+#include "probecache.h"
+
+#include <boost/thread/locks.hpp>
+
+#include <string.h>
+
+ProbeInfo ProbeInfo::capture(const AVFormatContext* formatContext)
+{
+    ProbeInfo info;
+    info.formatName = formatContext->iformat->name;
+    info.duration = formatContext->duration;
+
+    for (unsigned i = 0; i < formatContext->nb_streams; ++i)
+    {
+        const AVStream* stream = formatContext->streams[i];
+        const AVCodecContext* codec = stream->codec;
+        Stream item;
+        item.codecType = codec->codec_type;
+        item.codecId = codec->codec_id;
+        item.width = codec->width;
+        item.height = codec->height;
+        item.pixelFormat = codec->pix_fmt;
+        item.sampleRate = codec->sample_rate;
+        item.channels = codec->channels;
+        item.channelLayout = codec->channel_layout;
+        item.sampleFormat = codec->sample_fmt;
+        item.duration = stream->duration;
+        item.frameCount = stream->nb_frames;
+        item.timeBase = stream->time_base;
+        item.avgFrameRate = stream->avg_frame_rate;
+        item.realFrameRate = stream->r_frame_rate;
+        if (codec->extradata_size > 0)
+        {
+            item.extradata.assign(codec->extradata, codec->extradata + codec->extradata_size);
+        }
+        info.streams.push_back(item);
+    }
+
+    return info;
+}
+
+bool ProbeInfo::apply(AVFormatContext* formatContext) const
+{
+    // A bounded probe may miss streams that start late, but must not find different ones
+    if (formatContext->nb_streams < streams.size())
+    {
+        return false;
+    }
+    // Recorded durations are in the stream time base, which comes from the header
+    for (size_t i = 0; i < streams.size(); ++i)
+    {
+        const AVStream* stream = formatContext->streams[i];
+        const AVCodecContext* codec = stream->codec;
+        if (codec->codec_type != streams[i].codecType || codec->codec_id != streams[i].codecId ||
+            av_cmp_q(stream->time_base, streams[i].timeBase) != 0)
+        {
+            return false;
+        }
+    }
+
+    if (formatContext->duration == AV_NOPTS_VALUE || formatContext->duration <= 0)
+    {
+        formatContext->duration = duration;
+    }
+
+    for (size_t i = 0; i < streams.size(); ++i)
+    {
+        AVStream* stream = formatContext->streams[i];
+        AVCodecContext* codec = stream->codec;
+        const Stream& item = streams[i];
+
+        if (codec->width <= 0 || codec->height <= 0)
+        {
+            codec->width = item.width;
+            codec->height = item.height;
+        }
+        if (codec->pix_fmt == AV_PIX_FMT_NONE)
+        {
+            codec->pix_fmt = item.pixelFormat;
+        }
+        if (codec->sample_rate <= 0)
+        {
+            codec->sample_rate = item.sampleRate;
+        }
+        if (codec->channels <= 0)
+        {
+            codec->channels = item.channels;
+        }
+        if (codec->channel_layout == 0)
+        {
+            codec->channel_layout = item.channelLayout;
+        }
+        if (codec->sample_fmt == AV_SAMPLE_FMT_NONE)
+        {
+            codec->sample_fmt = item.sampleFormat;
+        }
+        if (stream->duration == AV_NOPTS_VALUE || stream->duration <= 0)
+        {
+            stream->duration = item.duration;
+        }
+        if (stream->nb_frames <= 0)
+        {
+            stream->nb_frames = item.frameCount;
+        }
+        if (stream->avg_frame_rate.num <= 0 || stream->avg_frame_rate.den <= 0)
+        {
+            stream->avg_frame_rate = item.avgFrameRate;
+        }
+        if (stream->r_frame_rate.num <= 0 || stream->r_frame_rate.den <= 0)
+        {
+            stream->r_frame_rate = item.realFrameRate;
+        }
+
+        // e.g. parameter sets that only come in band, which the decoder needs up front
+        if (codec->extradata_size <= 0 && !item.extradata.empty())
+        {
+            const int size = int(item.extradata.size());
+            uint8_t* extradata =
+                static_cast<uint8_t*>(av_mallocz(size + AV_INPUT_BUFFER_PADDING_SIZE));
+            if (extradata == nullptr)
+            {
+                return false;
+            }
+            memcpy(extradata, item.extradata.data(), size);
+            av_free(codec->extradata);
+            codec->extradata = extradata;
+            codec->extradata_size = size;
+        }
+    }
+
+    return true;
+}
+
+ProbeCache ProbeCache::s_instance;
+
+ProbeCache& ProbeCache::instance() { return s_instance; }
+
+bool ProbeCache::lookup(const PathType& file, const FileStamp& stamp, ProbeInfo* info)
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    auto it = m_lookup.find(file);
+    if (it == m_lookup.end())
+    {
+        return false;
+    }
+    if (it->second->stamp != stamp)
+    {
+        m_entries.erase(it->second);
+        m_lookup.erase(it);
+        return false;
+    }
+
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    *info = it->second->info;
+    return true;
+}
+
+void ProbeCache::store(const PathType& file, const FileStamp& stamp, const ProbeInfo& info)
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    auto it = m_lookup.find(file);
+    if (it != m_lookup.end())
+    {
+        m_entries.erase(it->second);
+        m_lookup.erase(it);
+    }
+
+    const Entry entry = {file, stamp, info};
+    m_entries.push_front(entry);
+    m_lookup[file] = m_entries.begin();
+
+    if (m_entries.size() > MAX_ENTRIES)
+    {
+        m_lookup.erase(m_entries.back().file);
+        m_entries.pop_back();
+    }
+}
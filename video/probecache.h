@@ -0,0 +1,83 @@
+#pragma once
+
+#include "filestamp.h"
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include <boost/thread/mutex.hpp>
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+// What avformat_find_stream_info() found out about a file, to reopen it quickly.
+struct ProbeInfo
+{
+    struct Stream
+    {
+        AVMediaType codecType;
+        AVCodecID codecId;
+        int width;
+        int height;
+        AVPixelFormat pixelFormat;
+        int sampleRate;
+        int channels;
+        uint64_t channelLayout;
+        AVSampleFormat sampleFormat;
+        int64_t duration;  // stream time base
+        int64_t frameCount;
+        AVRational timeBase;
+        AVRational avgFrameRate;
+        AVRational realFrameRate;
+        std::vector<uint8_t> extradata;
+    };
+
+    std::string formatName;
+    int64_t duration;  // AV_TIME_BASE
+    std::vector<Stream> streams;
+
+    static ProbeInfo capture(const AVFormatContext* formatContext);
+
+    // Fills in what a bounded probe left unknown. Returns false if the streams
+    // found don't match the recorded layout, which calls for a full probe.
+    bool apply(AVFormatContext* formatContext) const;
+};
+
+// Process-wide probe results keyed by path, valid while size and mtime don't change.
+// Least recently used entries are dropped beyond MAX_ENTRIES.
+class ProbeCache
+{
+   public:
+    static ProbeCache& instance();
+
+    bool lookup(const PathType& file, const FileStamp& stamp, ProbeInfo* info);
+    void store(const PathType& file, const FileStamp& stamp, const ProbeInfo& info);
+
+   private:
+    enum
+    {
+        MAX_ENTRIES = 256,
+    };
+
+    struct Entry
+    {
+        PathType file;
+        FileStamp stamp;
+        ProbeInfo info;
+    };
+    typedef std::list<Entry> EntryList;
+
+    ProbeCache() {}
+
+    ProbeCache(const ProbeCache&) = delete;
+    ProbeCache& operator=(const ProbeCache&) = delete;
+
+    static ProbeCache s_instance;
+
+    boost::mutex m_mutex;
+    EntryList m_entries;  // most recently used first
+    std::map<PathType, EntryList::iterator> m_lookup;
+};
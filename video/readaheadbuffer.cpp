@@ -0,0 +1,225 @@
+#include "readaheadbuffer.h"
+
+#include <boost/chrono.hpp>
+
+#include <algorithm>
+#include <string.h>
+
+namespace
+{
+enum
+{
+    MIN_CHUNK_SIZE = 64 * 1024,
+    MAX_CHUNK_SIZE = 4 * 1024 * 1024,
+    INITIAL_CHUNK_SIZE = 256 * 1024,
+};
+
+// Aim for source reads of about this duration at the measured throughput.
+const double TARGET_READ_SECS = 0.05;
+
+// Granularity of the consumer's checks for boost::thread interruption.
+const boost::chrono::milliseconds INTERRUPTION_POLL(50);
+
+}  // namespace
+
+ReadAheadBuffer::ReadAheadBuffer(size_t capacity, int64_t startPosition, ReadFunc read,
+                                 SeekFunc seek)
+    : m_ring(std::max<size_t>(capacity, 2 * MAX_CHUNK_SIZE)),
+      m_keepBehind(m_ring.size() / 8),
+      m_read(std::move(read)),
+      m_seek(std::move(seek)),
+      m_bufferStart(startPosition),
+      m_bufferEnd(startPosition),
+      m_readPos(startPosition),
+      m_eof(false),
+      m_error(false),
+      m_stop(false),
+      m_generation(0),
+      m_seekRequested(false),
+      m_seekResult(startPosition),
+      m_chunkSize(INITIAL_CHUNK_SIZE),
+      m_throughput(0)
+{
+    m_thread.reset(new boost::thread(&ReadAheadBuffer::prefetchThread, this));
+}
+
+ReadAheadBuffer::~ReadAheadBuffer()
+{
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    m_thread->join();
+}
+
+int64_t ReadAheadBuffer::position() const
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    return m_readPos;
+}
+
+int ReadAheadBuffer::read(uint8_t* buf, int size)
+{
+    // Called from FFmpeg callbacks: an interruption exception must not unwind through C code
+    boost::this_thread::disable_interruption noInterruption;
+
+    boost::unique_lock<boost::mutex> locker(m_mutex);
+    while (m_readPos >= m_bufferEnd && !m_eof && !m_error)
+    {
+        if (boost::this_thread::interruption_requested())
+        {
+            return -1;
+        }
+        m_cv.wait_for(locker, INTERRUPTION_POLL);
+    }
+
+    if (m_readPos >= m_bufferEnd)
+    {
+        return m_error ? -1 : 0;
+    }
+
+    const int64_t ringSize = m_ring.size();
+    const int64_t offset = m_readPos % ringSize;
+    const int length =
+        (int)std::min<int64_t>(std::min<int64_t>(size, m_bufferEnd - m_readPos), ringSize - offset);
+    locker.unlock();
+
+    // Nothing at or after m_readPos gets evicted, so the copy can run unlocked
+    memcpy(buf, &m_ring[offset], length);
+
+    locker.lock();
+    m_readPos += length;
+    locker.unlock();
+    m_cv.notify_all();
+
+    return length;
+}
+
+int64_t ReadAheadBuffer::seek(int64_t pos)
+{
+    boost::this_thread::disable_interruption noInterruption;
+
+    boost::unique_lock<boost::mutex> locker(m_mutex);
+    if (pos >= m_bufferStart && pos <= m_bufferEnd)
+    {
+        m_readPos = pos;
+        locker.unlock();
+        m_cv.notify_all();
+        return pos;
+    }
+
+    ++m_generation;
+    m_seekRequested = true;
+    m_bufferStart = m_bufferEnd = m_readPos = pos;
+    m_eof = false;
+    m_error = false;
+    m_cv.notify_all();
+
+    while (m_seekRequested)
+    {
+        if (boost::this_thread::interruption_requested())
+        {
+            return -1;
+        }
+        m_cv.wait_for(locker, INTERRUPTION_POLL);
+    }
+
+    return m_seekResult;
+}
+
+void ReadAheadBuffer::prefetchThread()
+{
+    typedef boost::chrono::steady_clock Clock;
+
+    const int64_t ringSize = m_ring.size();
+
+    boost::unique_lock<boost::mutex> locker(m_mutex);
+    for (;;)
+    {
+        // Space is what is free plus what lies far enough behind the read position
+        auto writable = [this, ringSize]()
+        {
+            const int64_t evictable =
+                std::max<int64_t>(0, m_readPos - m_keepBehind - m_bufferStart);
+            return ringSize - (m_bufferEnd - m_bufferStart) + evictable;
+        };
+
+        m_cv.wait(locker, [this, &writable]()
+                  {
+                      return m_stop || m_seekRequested ||
+                             (!m_eof && !m_error && writable() >= MIN_CHUNK_SIZE);
+                  });
+
+        if (m_stop)
+        {
+            return;
+        }
+
+        const unsigned generation = m_generation;
+
+        if (m_seekRequested)
+        {
+            const int64_t target = m_readPos;
+            locker.unlock();
+            const int64_t result = m_seek(target);
+            locker.lock();
+
+            if (generation == m_generation)
+            {
+                m_seekRequested = false;
+                m_seekResult = result;
+                m_error = result < 0;
+                m_cv.notify_all();
+            }
+            continue;
+        }
+
+        // Evict just enough old bytes to make room for the next chunk
+        const int64_t wanted = std::min<int64_t>(m_chunkSize, writable());
+        const int64_t overflow = (m_bufferEnd - m_bufferStart) + wanted - ringSize;
+        if (overflow > 0)
+        {
+            m_bufferStart += overflow;
+        }
+
+        const int64_t writePos = m_bufferEnd;
+        const int64_t offset = writePos % ringSize;
+        const int length = (int)std::min<int64_t>(wanted, ringSize - offset);
+
+        locker.unlock();
+        const auto readStart = Clock::now();
+        const int result = m_read(&m_ring[offset], length);
+        const double readSecs = boost::chrono::duration<double>(Clock::now() - readStart).count();
+        locker.lock();
+
+        if (generation != m_generation)
+        {
+            continue;  // a seek moved the window while reading
+        }
+
+        if (result > 0)
+        {
+            m_bufferEnd += result;
+
+            if (readSecs > 0)
+            {
+                const double rate = result / readSecs;
+                m_throughput = (m_throughput > 0) ? 0.8 * m_throughput + 0.2 * rate : rate;
+                const double chunk = m_throughput * TARGET_READ_SECS;
+                m_chunkSize =
+                    (int)std::max<double>(MIN_CHUNK_SIZE, std::min<double>(MAX_CHUNK_SIZE, chunk));
+            }
+        }
+        else if (result == 0)
+        {
+            m_eof = true;
+        }
+        else
+        {
+            m_error = true;
+        }
+
+        m_cv.notify_all();
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+// I/O prefetch stage. A background thread keeps up to `capacity` bytes of the
+// upcoming stream in a ring buffer, so a slow or stalling device does not
+// block the demuxer. Reads are sized adaptively from the measured throughput:
+// big on fast media to save calls, small on slow media to hand data over sooner.
+// Seeks inside the buffered window (which keeps some bytes behind the read
+// position too) are served without touching the device.
+//
+// The source functions are only ever called from the prefetch thread.
+class ReadAheadBuffer
+{
+   public:
+    // Returns the number of bytes read, 0 at the end of stream, < 0 on error.
+    typedef std::function<int(uint8_t* buf, int size)> ReadFunc;
+    // Absolute seek; returns the new position or < 0 on error.
+    typedef std::function<int64_t(int64_t pos)> SeekFunc;
+
+    ReadAheadBuffer(size_t capacity, int64_t startPosition, ReadFunc read, SeekFunc seek);
+    ~ReadAheadBuffer();
+
+    ReadAheadBuffer(const ReadAheadBuffer&) = delete;
+    ReadAheadBuffer& operator=(const ReadAheadBuffer&) = delete;
+
+    // Both return < 0 if the calling boost::thread gets interrupted while waiting.
+    // read returns 0 at the end of stream.
+    int read(uint8_t* buf, int size);
+    int64_t seek(int64_t pos);
+
+    int64_t position() const;
+
+   private:
+    void prefetchThread();
+
+    std::vector<uint8_t> m_ring;
+    const int64_t m_keepBehind;
+
+    ReadFunc m_read;
+    SeekFunc m_seek;
+
+    mutable boost::mutex m_mutex;
+    boost::condition_variable m_cv;
+
+    // Stream offsets; bytes in [m_bufferStart, m_bufferEnd) are held in the ring
+    int64_t m_bufferStart;
+    int64_t m_bufferEnd;
+    int64_t m_readPos;
+
+    bool m_eof;
+    bool m_error;
+    bool m_stop;
+
+    // Out-of-window seeks bump the generation so in-flight reads get discarded
+    unsigned m_generation;
+    bool m_seekRequested;
+    int64_t m_seekResult;
+
+    int m_chunkSize;
+    double m_throughput;  // bytes per second, exponentially smoothed
+
+    std::unique_ptr<boost::thread> m_thread;
+};
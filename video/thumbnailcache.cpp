@@ -0,0 +1,240 @@
+#include "thumbnailcache.h"
+
+#include <boost/thread/locks.hpp>
+
+#include <fstream>
+#include <iterator>
+#include <string.h>
+
+// Sidecar layout, little-endian:
+//   char[4]  magic "FTHB"
+//   uint32   version
+//   int64    media file size
+//   int64    media file mtime
+//   uint32   stream index
+//   uint32   1 if generation completed
+//   uint32   thumbnail count
+//   thumbnails, each as int64 position, uint32 width, uint32 height, packed RGB24 pixels
+//
+// Pixels are stored raw: at a few dozen KB per thumbnail the file stays small next
+// to the media, and loading costs a single read.
+
+namespace
+{
+
+const char MAGIC[4] = {'F', 'T', 'H', 'B'};
+const uint32_t VERSION = 1;
+
+// Sanity limit on stored dimensions, against reading garbage
+const uint32_t MAX_DIMENSION = 4096;
+
+void putFixed(std::vector<uint8_t>* out, uint64_t value, int bytes)
+{
+    for (int i = 0; i < bytes; ++i)
+    {
+        out->push_back(uint8_t(value >> (8 * i)));
+    }
+}
+
+bool getFixed(const uint8_t** p, const uint8_t* end, int bytes, uint64_t* value)
+{
+    if (end - *p < bytes)
+    {
+        return false;
+    }
+    *value = 0;
+    for (int i = 0; i < bytes; ++i)
+    {
+        *value |= uint64_t(*(*p)++) << (8 * i);
+    }
+    return true;
+}
+
+}  // namespace
+
+ThumbnailCache::ThumbnailCache(int64_t byteBudget) : m_byteBudget(byteBudget), m_bytes(0) {}
+
+void ThumbnailCache::add(std::shared_ptr<const Thumbnail> thumbnail)
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    addLocked(std::move(thumbnail));
+}
+
+void ThumbnailCache::addLocked(std::shared_ptr<const Thumbnail> thumbnail)
+{
+    const int64_t position = thumbnail->position;
+    auto it = m_entries.find(position);
+    if (it != m_entries.end())
+    {
+        m_bytes -= sizeOf(*it->second.thumbnail);
+        m_lru.erase(it->second.lru);
+        m_entries.erase(it);
+    }
+
+    m_bytes += sizeOf(*thumbnail);
+    m_lru.push_front(position);
+    Entry entry = {std::move(thumbnail), m_lru.begin()};
+    m_entries.insert(std::make_pair(position, entry));
+
+    while (m_bytes > m_byteBudget && m_lru.size() > 1)
+    {
+        auto victim = m_entries.find(m_lru.back());
+        m_bytes -= sizeOf(*victim->second.thumbnail);
+        m_entries.erase(victim);
+        m_lru.pop_back();
+    }
+}
+
+std::shared_ptr<const Thumbnail> ThumbnailCache::findNearest(int64_t position)
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    if (m_entries.empty())
+    {
+        return nullptr;
+    }
+
+    auto it = m_entries.lower_bound(position);
+    if (it == m_entries.end())
+    {
+        --it;
+    }
+    else if (it != m_entries.begin())
+    {
+        auto before = std::prev(it);
+        if (position - before->first < it->first - position)
+        {
+            it = before;
+        }
+    }
+
+    m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+    return it->second.thumbnail;
+}
+
+bool ThumbnailCache::contains(int64_t position) const
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    return m_entries.count(position) != 0;
+}
+
+bool ThumbnailCache::wouldEvict(int64_t bytes) const
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    return m_bytes + bytes > m_byteBudget;
+}
+
+size_t ThumbnailCache::size() const
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    return m_entries.size();
+}
+
+int64_t ThumbnailCache::bytes() const
+{
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    return m_bytes;
+}
+
+bool ThumbnailCache::load(const PathType& sidecar, const FileStamp& stamp, int streamIndex,
+                          bool* complete)
+{
+    std::ifstream s(sidecar.c_str(), std::ios::binary);
+    if (!s)
+    {
+        return false;
+    }
+    const std::vector<uint8_t> data((std::istreambuf_iterator<char>(s)),
+                                    std::istreambuf_iterator<char>());
+
+    const uint8_t* p = data.data();
+    const uint8_t* const end = p + data.size();
+
+    uint64_t version, size, mtime, stream, done, count;
+    if (end - p < (int)sizeof(MAGIC) || memcmp(p, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        return false;
+    }
+    p += sizeof(MAGIC);
+    if (!getFixed(&p, end, 4, &version) || version != VERSION || !getFixed(&p, end, 8, &size) ||
+        !getFixed(&p, end, 8, &mtime) || !getFixed(&p, end, 4, &stream) ||
+        !getFixed(&p, end, 4, &done) || !getFixed(&p, end, 4, &count))
+    {
+        return false;
+    }
+    if (int64_t(size) != stamp.size || int64_t(mtime) != stamp.mtime ||
+        int(stream) != streamIndex)
+    {
+        return false;  // stale, or not ours
+    }
+
+    std::vector<std::shared_ptr<const Thumbnail>> thumbnails;
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        uint64_t position, width, height;
+        if (!getFixed(&p, end, 8, &position) || !getFixed(&p, end, 4, &width) ||
+            !getFixed(&p, end, 4, &height) || width == 0 || width > MAX_DIMENSION ||
+            height == 0 || height > MAX_DIMENSION)
+        {
+            return false;
+        }
+        const size_t pixelBytes = size_t(width * height * 3);
+        if (size_t(end - p) < pixelBytes)
+        {
+            return false;
+        }
+
+        auto thumbnail = std::make_shared<Thumbnail>();
+        thumbnail->position = int64_t(position);
+        thumbnail->width = int(width);
+        thumbnail->height = int(height);
+        thumbnail->rgb.assign(p, p + pixelBytes);
+        p += pixelBytes;
+        thumbnails.push_back(std::move(thumbnail));
+    }
+
+    boost::lock_guard<boost::mutex> locker(m_mutex);
+    for (auto& thumbnail : thumbnails)
+    {
+        addLocked(std::move(thumbnail));
+    }
+    *complete = done != 0;
+    return true;
+}
+
+bool ThumbnailCache::save(const PathType& sidecar, const FileStamp& stamp, int streamIndex,
+                          bool complete) const
+{
+    std::vector<uint8_t> data(MAGIC, MAGIC + sizeof(MAGIC));
+    putFixed(&data, VERSION, 4);
+    putFixed(&data, stamp.size, 8);
+    putFixed(&data, stamp.mtime, 8);
+    putFixed(&data, streamIndex, 4);
+    putFixed(&data, complete ? 1 : 0, 4);
+
+    {
+        boost::lock_guard<boost::mutex> locker(m_mutex);
+        data.reserve(data.size() + 4 + size_t(m_bytes) + m_entries.size() * 16);
+        putFixed(&data, m_entries.size(), 4);
+        for (const auto& item : m_entries)
+        {
+            const Thumbnail& thumbnail = *item.second.thumbnail;
+            putFixed(&data, thumbnail.position, 8);
+            putFixed(&data, thumbnail.width, 4);
+            putFixed(&data, thumbnail.height, 4);
+            data.insert(data.end(), thumbnail.rgb.begin(), thumbnail.rgb.end());
+        }
+    }
+
+    std::ofstream s(sidecar.c_str(), std::ios::binary | std::ios::trunc);
+    s.write((const char*)data.data(), data.size());
+    return bool(s);
+}
+
+PathType ThumbnailCache::sidecarPath(const PathType& mediaFile)
+{
+#ifdef _WIN32
+    return mediaFile + L".thumbs";
+#else
+    return mediaFile + ".thumbs";
+#endif
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "decoderinterface.h"
+#include "filestamp.h"
+
+#include <boost/thread/mutex.hpp>
+
+#include <list>
+#include <map>
+#include <memory>
+
+// Seek bar thumbnails keyed by position, within a byte budget; the least recently
+// looked up ones get evicted first. Filled by the generator thread while the UI
+// reads, so every method locks.
+class ThumbnailCache
+{
+   public:
+    explicit ThumbnailCache(int64_t byteBudget);
+
+    ThumbnailCache(const ThumbnailCache&) = delete;
+    ThumbnailCache& operator=(const ThumbnailCache&) = delete;
+
+    // Replaces a thumbnail at the same position.
+    void add(std::shared_ptr<const Thumbnail> thumbnail);
+
+    // The thumbnail closest to position, or null if there are none.
+    std::shared_ptr<const Thumbnail> findNearest(int64_t position);
+
+    bool contains(int64_t position) const;
+
+    // Whether adding another thumbnail of that size would evict one.
+    bool wouldEvict(int64_t bytes) const;
+
+    size_t size() const;
+    int64_t bytes() const;
+
+    // The sidecar records whether generation ran to completion, so a partial
+    // cache from an interrupted run isn't mistaken for a complete one.
+    bool load(const PathType& sidecar, const FileStamp& stamp, int streamIndex, bool* complete);
+    bool save(const PathType& sidecar, const FileStamp& stamp, int streamIndex,
+              bool complete) const;
+
+    static PathType sidecarPath(const PathType& mediaFile);
+
+   private:
+    typedef std::list<int64_t> LruList;  // positions, most recently used first
+
+    struct Entry
+    {
+        std::shared_ptr<const Thumbnail> thumbnail;
+        LruList::iterator lru;
+    };
+
+    static int64_t sizeOf(const Thumbnail& thumbnail) { return thumbnail.rgb.size(); }
+
+    void addLocked(std::shared_ptr<const Thumbnail> thumbnail);
+
+    const int64_t m_byteBudget;
+
+    mutable boost::mutex m_mutex;
+    std::map<int64_t, Entry> m_entries;
+    LruList m_lru;
+    int64_t m_bytes;
+};
@@ -0,0 +1,196 @@
+#include "thumbnailrunnable.h"
+#include "makeguard.h"
+#include "thumbnailcache.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <limits>
+
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(55,28,1)
+#define av_frame_alloc  avcodec_alloc_frame
+#endif
+
+namespace
+{
+
+enum
+{
+    THUMBNAIL_WIDTH = 160,
+    INITIAL_STEPS = 16,         // thumbnails in the first, coarsest pass
+    MAX_STEPS = 16 * 1024,
+    MAX_PACKETS_TO_KEYFRAME = 2000,
+    MAX_DRAIN_CALLS = 16,
+};
+
+// Passes stop refining once samples would be closer than this
+const double MIN_SPACING_SECS = 2.;
+
+void lowerThreadPriority()
+{
+#ifdef _WIN32
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#elif defined(__linux__)
+    sched_param param = {};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+}
+
+int thumbnailHeight(const AVCodecContext* codecContext)
+{
+    double aspect = double(codecContext->width) / codecContext->height;
+    if (codecContext->sample_aspect_ratio.num > 0 && codecContext->sample_aspect_ratio.den > 0)
+    {
+        aspect *= av_q2d(codecContext->sample_aspect_ratio);
+    }
+    return std::max(2, int(THUMBNAIL_WIDTH / aspect + 0.5) & ~1);
+}
+
+}  // namespace
+
+void ThumbnailRunnable::operator()()
+{
+    CHANNEL_LOG(ffmpeg_threads) << "Thumbnail thread started";
+    TraceRecorder::instance().setThreadName("thumbnails");
+    TRACE_SPAN("generate thumbnails");
+    lowerThreadPriority();
+
+    // Keyframes are all we ever show
+    m_codecContext->skip_frame = AVDISCARD_NONKEY;
+
+    AVFrame* frame = av_frame_alloc();
+    auto frameGuard = MakeGuard(&frame, av_frame_free);
+    SwsContext* scaler = nullptr;
+    auto scalerGuard = MakeGuard(&scaler, [](SwsContext** context) { sws_freeContext(*context); });
+
+    const AVStream* stream = m_formatContext->streams[m_streamIndex];
+    const int64_t start = (stream->start_time != AV_NOPTS_VALUE) ? stream->start_time : 0;
+    const int64_t minSpacing = int64_t(MIN_SPACING_SECS / av_q2d(stream->time_base));
+    const int64_t thumbnailBytes =
+        int64_t(THUMBNAIL_WIDTH) * thumbnailHeight(m_codecContext.get()) * 3;
+
+    bool budgetUsedUp = false;
+    for (int steps = INITIAL_STEPS; !budgetUsedUp; steps *= 2)
+    {
+        // Later passes only visit the points halfway between the ones done before
+        const bool firstPass = steps == INITIAL_STEPS;
+        for (int i = firstPass ? 0 : 1; i < steps; i += firstPass ? 1 : 2)
+        {
+            if (boost::this_thread::interruption_requested())
+            {
+                CHANNEL_LOG(ffmpeg_threads) << "Thumbnail generation broken";
+                return;
+            }
+            if (m_cache->wouldEvict(thumbnailBytes))
+            {
+                budgetUsedUp = true;
+                break;
+            }
+
+            generate(start + m_duration * i / steps, frame, &scaler);
+        }
+
+        if (m_duration / (steps * 2) < minSpacing || steps >= MAX_STEPS)
+        {
+            break;
+        }
+    }
+
+    CHANNEL_LOG(ffmpeg_threads) << "Thumbnails generated: " << m_cache->size() << ", "
+                                << m_cache->bytes() << " bytes";
+
+    if (!m_sidecar.empty() && !m_cache->save(m_sidecar, m_stamp, m_streamIndex, true))
+    {
+        CHANNEL_LOG(ffmpeg_threads) << "Couldn't save the thumbnails";
+    }
+}
+
+// Decodes the keyframe at or before position into the cache; false if there was none.
+bool ThumbnailRunnable::generate(int64_t position, AVFrame* frame, SwsContext** scaler)
+{
+    AVFormatContext* formatContext = m_formatContext.get();
+    AVCodecContext* codecContext = m_codecContext.get();
+
+    if (avformat_seek_file(formatContext, m_streamIndex, std::numeric_limits<int64_t>::min(),
+                           position, position, 0) < 0)
+    {
+        return false;
+    }
+    avcodec_flush_buffers(codecContext);
+
+    AVPacket packet;
+    for (int i = 0; i < MAX_PACKETS_TO_KEYFRAME; ++i)
+    {
+        if (av_read_frame(formatContext, &packet) < 0)
+        {
+            return false;
+        }
+        auto packetGuard = MakeGuard(&packet, av_free_packet);
+
+        if (packet.stream_index != m_streamIndex || !(packet.flags & AV_PKT_FLAG_KEY))
+        {
+            continue;
+        }
+
+        // Nearby sample points often land on the same keyframe
+        const int64_t pts = (packet.pts != AV_NOPTS_VALUE) ? packet.pts : packet.dts;
+        if (pts != AV_NOPTS_VALUE && m_cache->contains(pts))
+        {
+            return true;
+        }
+
+        int frameFinished = 0;
+        {
+            TRACE_SPAN("decode thumbnail");
+            avcodec_decode_video2(codecContext, frame, &frameFinished, &packet);
+
+            AVPacket drainPacket;
+            av_init_packet(&drainPacket);
+            drainPacket.data = nullptr;
+            drainPacket.size = 0;
+            for (int j = 0; !frameFinished && j < MAX_DRAIN_CALLS; ++j)
+            {
+                avcodec_decode_video2(codecContext, frame, &frameFinished, &drainPacket);
+            }
+        }
+        if (!frameFinished)
+        {
+            return false;
+        }
+
+        auto thumbnail = std::make_shared<Thumbnail>();
+        const int64_t stamp = av_frame_get_best_effort_timestamp(frame);
+        thumbnail->position =
+            (stamp != AV_NOPTS_VALUE) ? stamp : (pts != AV_NOPTS_VALUE) ? pts : position;
+        thumbnail->width = THUMBNAIL_WIDTH;
+        thumbnail->height = thumbnailHeight(codecContext);
+        thumbnail->rgb.resize(size_t(thumbnail->width) * thumbnail->height * 3);
+
+        *scaler = sws_getCachedContext(*scaler, frame->width, frame->height,
+                                       (AVPixelFormat)frame->format, thumbnail->width,
+                                       thumbnail->height, AV_PIX_FMT_RGB24, SWS_BILINEAR,
+                                       nullptr, nullptr, nullptr);
+        if (*scaler == nullptr)
+        {
+            return false;
+        }
+
+        uint8_t* const data[] = {thumbnail->rgb.data()};
+        const int linesize[] = {thumbnail->width * 3};
+        TRACE_SPAN("scale thumbnail");
+        if (sws_scale(*scaler, frame->data, frame->linesize, 0, frame->height, data, linesize) <= 0)
+        {
+            return false;
+        }
+
+        m_cache->add(std::move(thumbnail));
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "ffmpegdecoder.h"
+#include "filestamp.h"
+
+class ThumbnailCache;
+
+// Fills the seek bar thumbnail cache from a demuxer and decoder of its own, so
+// playback's read position and codec state are never touched. Samples the file
+// coarse to fine, each pass halving the spacing, so previews soon exist all
+// along the seek bar; stops once the cache budget is used up.
+class ThumbnailRunnable
+{
+	std::shared_ptr<AVFormatContext> m_formatContext;
+	std::shared_ptr<AVCodecContext> m_codecContext;
+	int m_streamIndex;
+	int64_t m_duration;  // stream time base
+	std::shared_ptr<ThumbnailCache> m_cache;
+	PathType m_sidecar;  // empty if not persisted
+	FileStamp m_stamp;
+
+	bool generate(int64_t position, AVFrame* frame, SwsContext** scaler);
+
+public:
+	// Takes ownership of formatContext and of the opened codecContext
+	ThumbnailRunnable(AVFormatContext* formatContext, AVCodecContext* codecContext,
+					  int streamIndex, int64_t duration, std::shared_ptr<ThumbnailCache> cache,
+					  const PathType& sidecar, const FileStamp& stamp)
+		: m_formatContext(formatContext, [](AVFormatContext* context) { FFmpegDecoder::closeInput(&context); }),
+		m_codecContext(codecContext, [](AVCodecContext* context) { avcodec_free_context(&context); }),
+		m_streamIndex(streamIndex),
+		m_duration(duration),
+		m_cache(std::move(cache)),
+		m_sidecar(sidecar),
+		m_stamp(stamp)
+	{}
+	void operator()();
+};
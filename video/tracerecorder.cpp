@@ -0,0 +1,157 @@
+#include "tracerecorder.h"
+
+#include <boost/thread/locks.hpp>
+
+#include <fstream>
+#include <iomanip>
+
+TraceRecorder TraceRecorder::s_instance;
+
+TraceRecorder& TraceRecorder::instance() { return s_instance; }
+
+TraceRecorder::TraceRecorder()
+    : m_enabled(false), m_origin(GetHiResTime()), m_currentThread(&releaseThreadState)
+{
+}
+
+TraceRecorder::ThreadBuffer::~ThreadBuffer()
+{
+    for (Chunk* chunk = head.next; chunk != nullptr;)
+    {
+        Chunk* next = chunk->next;
+        delete chunk;
+        chunk = next;
+    }
+}
+
+TraceRecorder::ThreadState* TraceRecorder::threadState()
+{
+    ThreadState* state = m_currentThread.get();
+    if (state == nullptr)
+    {
+        state = new ThreadState();
+        state->buffer = nullptr;
+        m_currentThread.reset(state);
+    }
+    return state;
+}
+
+TraceRecorder::ThreadBuffer* TraceRecorder::threadBuffer()
+{
+    ThreadState* state = threadState();
+    if (state->buffer == nullptr)
+    {
+        boost::lock_guard<boost::mutex> locker(m_registryMutex);
+        for (const auto& buffer : m_threads)
+        {
+            if (buffer->retired && buffer->name == state->name)
+            {
+                buffer->retired = false;
+                state->buffer = buffer.get();
+                return state->buffer;
+            }
+        }
+        m_threads.emplace_back(new ThreadBuffer(int(m_threads.size()) + 1));
+        state->buffer = m_threads.back().get();
+        state->buffer->name = state->name;
+    }
+    return state->buffer;
+}
+
+void TraceRecorder::releaseThreadState(ThreadState* state)
+{
+    if (state->buffer != nullptr)
+    {
+        boost::lock_guard<boost::mutex> locker(s_instance.m_registryMutex);
+        state->buffer->retired = true;
+    }
+    delete state;
+}
+
+void TraceRecorder::setThreadName(const char* name)
+{
+    ThreadState* state = threadState();
+    state->name = name;
+    if (state->buffer != nullptr)
+    {
+        boost::lock_guard<boost::mutex> locker(m_registryMutex);
+        state->buffer->name = name;
+    }
+}
+
+void TraceRecorder::addSpan(const char* name, double begin, double end)
+{
+    if (!isEnabled())
+    {
+        return;
+    }
+
+    ThreadBuffer* buffer = threadBuffer();
+    Chunk* chunk = buffer->tail;
+    unsigned count = chunk->count.load(boost::memory_order_relaxed);
+    if (count == CHUNK_SIZE)
+    {
+        if (buffer->chunks == MAX_CHUNKS_PER_THREAD)
+        {
+            buffer->dropped.fetch_add(1, boost::memory_order_relaxed);
+            return;
+        }
+        Chunk* next = new Chunk();
+        chunk->next.store(next, boost::memory_order_release);
+        buffer->tail = chunk = next;
+        ++buffer->chunks;
+        count = 0;
+    }
+
+    Event& event = chunk->events[count];
+    event.name = name;
+    event.begin = begin;
+    event.end = end;
+    chunk->count.store(count + 1, boost::memory_order_release);
+}
+
+bool TraceRecorder::save(const PathType& file) const
+{
+    std::ofstream s(file.c_str());
+    if (!s)
+    {
+        return false;
+    }
+
+    s << std::fixed << std::setprecision(3);
+    s << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    s << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"FFmpegDecoder\"}}";
+
+    boost::lock_guard<boost::mutex> locker(m_registryMutex);
+    for (const auto& buffer : m_threads)
+    {
+        if (!buffer->name.empty())
+        {
+            s << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+              << ",\"args\":{\"name\":\"" << buffer->name << "\"}}";
+        }
+
+        for (const Chunk* chunk = &buffer->head; chunk != nullptr;
+             chunk = chunk->next.load(boost::memory_order_acquire))
+        {
+            const unsigned count = chunk->count.load(boost::memory_order_acquire);
+            for (unsigned i = 0; i < count; ++i)
+            {
+                const Event& event = chunk->events[i];
+                s << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                  << buffer->tid << ",\"ts\":" << (event.begin - m_origin) * 1000000.
+                  << ",\"dur\":" << (event.end - event.begin) * 1000000. << '}';
+            }
+        }
+
+        const unsigned dropped = buffer->dropped.load(boost::memory_order_relaxed);
+        if (dropped != 0)
+        {
+            s << ",\n{\"name\":\"dropped events\",\"ph\":\"C\",\"pid\":1,\"tid\":" << buffer->tid
+              << ",\"ts\":0,\"args\":{\"dropped\":" << dropped << "}}";
+        }
+    }
+
+    s << "\n]}\n";
+    return bool(s);
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "decoderinterface.h"
+
+#include <boost/atomic.hpp>
+#include <boost/preprocessor/cat.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+double GetHiResTime();
+
+// Records pipeline spans into per-thread buffers and writes them out as a
+// Chrome trace-event JSON file (chrome://tracing, ui.perfetto.dev), one track
+// per thread. Disabled by default; a disabled span costs one atomic load.
+//
+// Each thread appends only to its own chunked buffer and publishes events with
+// a release store, so recording never takes a lock. The registry mutex is
+// locked once per thread on its first event and while saving. Buffers are only
+// allocated on a thread's first event while enabled; the buffer of a thread that
+// has exited goes on with the next thread of the same name, on the same track.
+class TraceRecorder
+{
+   public:
+    static TraceRecorder& instance();
+
+    void start() { m_enabled = true; }
+    void stop() { m_enabled = false; }
+    bool isEnabled() const { return m_enabled.load(boost::memory_order_relaxed); }
+
+    // Names the calling thread's track; cheap while disabled.
+    void setThreadName(const char* name);
+
+    // name must have static storage duration; times come from GetHiResTime().
+    void addSpan(const char* name, double begin, double end);
+
+    // Writes everything recorded so far; safe to call while threads are recording.
+    bool save(const PathType& file) const;
+
+   private:
+    enum
+    {
+        CHUNK_SIZE = 4096,
+        MAX_CHUNKS_PER_THREAD = 256,
+    };
+
+    struct Event
+    {
+        const char* name;
+        double begin;
+        double end;
+    };
+
+    struct Chunk
+    {
+        Event events[CHUNK_SIZE];
+        boost::atomic<unsigned> count;
+        boost::atomic<Chunk*> next;
+
+        Chunk() : count(0), next(nullptr) {}
+    };
+
+    struct ThreadBuffer
+    {
+        int tid;
+        std::string name;
+        Chunk head;
+        Chunk* tail;
+        int chunks;
+        boost::atomic<unsigned> dropped;
+        bool retired;  // its thread exited; under the registry mutex
+
+        explicit ThreadBuffer(int tid)
+            : tid(tid), tail(&head), chunks(1), dropped(0), retired(false)
+        {
+        }
+        ~ThreadBuffer();
+    };
+
+    struct ThreadState
+    {
+        std::string name;
+        ThreadBuffer* buffer;  // none until the thread records while enabled
+    };
+
+    TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    ThreadState* threadState();
+    ThreadBuffer* threadBuffer();
+
+    static void releaseThreadState(ThreadState* state);
+
+    static TraceRecorder s_instance;
+
+    boost::atomic_bool m_enabled;
+    const double m_origin;
+
+    mutable boost::mutex m_registryMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> m_threads;
+
+    // Buffers are owned by m_threads so they outlive their threads.
+    boost::thread_specific_ptr<ThreadState> m_currentThread;
+};
+
+// Records the enclosing scope as a span.
+class TraceSpan
+{
+   public:
+    explicit TraceSpan(const char* name)
+        : m_name(TraceRecorder::instance().isEnabled() ? name : nullptr),
+          m_begin(m_name ? GetHiResTime() : 0)
+    {
+    }
+    ~TraceSpan()
+    {
+        if (m_name)
+        {
+            TraceRecorder::instance().addSpan(m_name, m_begin, GetHiResTime());
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+   private:
+    const char* m_name;
+    double m_begin;
+};
+
+#define TRACE_SPAN(name) TraceSpan BOOST_PP_CAT(traceSpan, __LINE__)(name)
@@ -7,4 +7,23 @@ struct VideoFrame
 	double m_displayTime;
 	int64_t m_duration;
 	FPicture m_image;
+	// The decoded picture itself, shown in place of m_image when it already is in the
+	// output format; a reference of its own into the decoder's buffers
+	AVFrame* m_source;
+
+	VideoFrame() : m_displayTime(0), m_duration(0), m_source(nullptr) {}
+
+	VideoFrame(const VideoFrame&) = delete;
+	VideoFrame& operator=(const VideoFrame&) = delete;
+
+	~VideoFrame()
+	{
+		av_frame_free(&m_source);
+	}
+
+	void free()
+	{
+		m_image.free();
+		av_frame_free(&m_source);
+	}
 };
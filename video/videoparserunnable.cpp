@@ -1,65 +1,405 @@
 #include "videoparserunnable.h"
 
-bool VideoParseRunnable::getVideoPacket(AVPacket* packet)
+#include <algorithm>
+#include <cmath>
+
+namespace
 {
+
+enum { MAX_DRAIN_CALLS = 16 };
+
+// Decode times further above the mean than this many deviations are rare enough to stall on
+const double DECODE_TIME_DEVIATIONS = 3.;
+// The queue grows at once but shrinks a frame at a time, at most this often
+const double FRAME_QUEUE_SHRINK_SECS = 2.;
+const double DEFAULT_FRAME_INTERVAL = 1. / 25;
+
+// Spread of the decode time per shown frame, as exponentially weighted mean and
+// variance, for sizing the presentation queue.
+class DecodeTimeSpread
+{
+public:
+    DecodeTimeSpread() : m_mean(0), m_variance(0), m_empty(true) {}
+
+    void add(double secs)
+    {
+        const double weight = 1. / 32;
+        if (m_empty)
+        {
+            m_mean = secs;
+            m_empty = false;
+            return;
+        }
+        const double delta = secs - m_mean;
+        m_mean += weight * delta;
+        m_variance = (1. - weight) * (m_variance + weight * delta * delta);
+    }
+
+    // Frames to queue so that the display never runs dry while one slow decode runs:
+    // the frame on screen plus those shown meanwhile
+    int queueDepth(double frameInterval) const
     {
-        boost::unique_lock<boost::mutex> locker(m_ffmpeg->m_packetsQueueMutex);
+        const double slowDecode = m_mean + DECODE_TIME_DEVIATIONS * std::sqrt(m_variance);
+        const int depth = 1 + int(std::ceil(slowDecode / frameInterval));
+        return std::min<int>(std::max<int>(depth, MIN_VIDEO_PICTURE_QUEUE_SIZE),
+                             MAX_VIDEO_PICTURE_QUEUE_SIZE);
+    }
 
-        while (m_ffmpeg->m_videoPacketsQueue.size() == 0)
+private:
+    double m_mean;
+    double m_variance;
+    bool m_empty;
+};
+
+// Quality is judged once per window: it steps down when frames came out late while the
+// thread was busy decoding, so I/O stalls don't count, and back up after a calm stretch.
+const double DEGRADATION_WINDOW_SECS = 1.;
+enum { LATE_FRAMES_TO_DEGRADE = 3 };  // per window
+const double DEGRADE_BUSY_RATIO = 0.75;  // share of the window spent decoding
+const double RECOVERY_BUSY_RATIO = 0.5;
+// A step back up that soon falls behind again doubles the calm stretch needed for the next
+const double MIN_RECOVERY_SECS = 3.;
+const double MAX_RECOVERY_SECS = 48.;
+
+class DegradationPolicy
+{
+public:
+    explicit DegradationPolicy(double now)
+        : m_level(DEGRADATION_NONE)
+        , m_recoverySecs(MIN_RECOVERY_SECS)
+        , m_lastRecoveryTime(-MAX_RECOVERY_SECS)
+        , m_calmSecs(0)
+    {
+        restart(now);
+    }
+
+    // Starts a new window, leaving out time spent paused or seeking
+    void restart(double now)
+    {
+        m_windowStart = now;
+        m_busySecs = 0;
+        m_lateFrames = 0;
+    }
+
+    void addDecodeTime(double secs) { m_busySecs += secs; }
+    void addLateFrame() { ++m_lateFrames; }
+
+    DecodingDegradation update(double now)
+    {
+        const double elapsed = now - m_windowStart;
+        if (elapsed < DEGRADATION_WINDOW_SECS)
         {
-            if (m_ffmpeg->m_isPaused && !m_ffmpeg->m_isVideoSeekingWhilePaused)
+            return m_level;
+        }
+
+        const double busy = m_busySecs / elapsed;
+        if (m_lateFrames >= LATE_FRAMES_TO_DEGRADE && busy >= DEGRADE_BUSY_RATIO)
+        {
+            m_calmSecs = 0;
+            if (m_level < DEGRADATION_LEVELS - 1)
             {
-                return false;
+                if (now - m_lastRecoveryTime < m_recoverySecs)
+                {
+                    m_recoverySecs = std::min(m_recoverySecs * 2, MAX_RECOVERY_SECS);
+                }
+                m_level = DecodingDegradation(m_level + 1);
             }
-            m_ffmpeg->m_packetsQueueCV.wait(locker);
+        }
+        else if (m_lateFrames == 0 && busy < RECOVERY_BUSY_RATIO)
+        {
+            m_calmSecs += elapsed;
+            if (m_level > DEGRADATION_NONE && m_calmSecs >= m_recoverySecs)
+            {
+                m_level = DecodingDegradation(m_level - 1);
+                m_calmSecs = 0;
+                m_lastRecoveryTime = now;
+            }
+        }
+        else
+        {
+            m_calmSecs = 0;
         }
 
-        *packet = m_ffmpeg->m_videoPacketsQueue.dequeue();
+        restart(now);
+        return m_level;
+    }
+
+private:
+    DecodingDegradation m_level;
+    double m_recoverySecs;
+    double m_lastRecoveryTime;
+    double m_calmSecs;
+
+    double m_windowStart;
+    double m_busySecs;
+    int m_lateFrames;
+};
+
+// Non-reference frames decoded on the way to an exact seek target are never shown and
+// nothing is predicted from them, so their decoding may be cut short (AVDISCARD_NONREF).
+// Scrubbing decodes keyframes only (AVDISCARD_NONKEY). Degraded quality discards on top.
+void setDiscard(AVCodecContext* codecContext, AVDiscard discard, DecodingDegradation level)
+{
+    const AVDiscard frameDiscard = (level >= DEGRADATION_KEYFRAMES_ONLY) ? AVDISCARD_NONKEY
+                                 : (level >= DEGRADATION_SKIP_NONREF) ? AVDISCARD_NONREF
+                                 : AVDISCARD_DEFAULT;
+    const AVDiscard loopFilterDiscard =
+        (level >= DEGRADATION_SKIP_LOOP_FILTER) ? AVDISCARD_ALL : AVDISCARD_DEFAULT;
+
+    // Frames that pass skip_frame are the very ones skip_idct and skip_loop_filter at the
+    // same level would spare, so only the loop filter gets a level of its own
+    codecContext->skip_frame = std::max(discard, frameDiscard);
+    codecContext->skip_loop_filter = loopFilterDiscard;
+}
+
+}  // namespace
+
+bool VideoParseRunnable::getVideoPacket(AVPacket* packet, unsigned* generation)
+{
+    const double waitStart = GetHiResTime();
+
+    FQueue& queue = m_ffmpeg->m_videoPacketsQueue;
+    queue.waitConsumer([this, &queue]()
+                       {
+                           return !queue.empty() ||
+                                  (m_ffmpeg->m_isPaused && !m_ffmpeg->m_isVideoSeekingWhilePaused);
+                       });
+    if (!queue.pop(packet, generation))
+    {
+        return false;  // paused, or only stale packets were left
     }
-    m_ffmpeg->m_packetsQueueCV.notify_all();
+
+    const double waitEnd = GetHiResTime();
+    m_ffmpeg->m_statistics.videoPacketWait.add(waitEnd - waitStart);
+    TraceRecorder::instance().addSpan("video packet wait", waitStart, waitEnd);
 
     return true;
 }
 
+// Only this thread changes the depth, so it reads it without locking
+void VideoParseRunnable::adaptFrameQueueDepth(int depth, double* lastShrinkTime)
+{
+    VQueue& frames = m_ffmpeg->m_videoFramesQueue;
+    const double now = GetHiResTime();
+    if (depth < frames.m_depth)
+    {
+        if (now - *lastShrinkTime < FRAME_QUEUE_SHRINK_SECS)
+        {
+            return;
+        }
+        depth = frames.m_depth - 1;
+    }
+    else if (depth == frames.m_depth)
+    {
+        return;
+    }
+    *lastShrinkTime = now;
+
+    CHANNEL_LOG(ffmpeg_sync) << "Frame queue depth " << frames.m_depth << " -> " << depth;
+    {
+        boost::lock_guard<boost::mutex> locker(m_ffmpeg->m_videoFramesMutex);
+        frames.setDepth(depth);
+    }
+
+    PipelineStatistics& statistics = m_ffmpeg->m_statistics;
+    statistics.frameQueueDepth = depth;
+    if (depth > statistics.maxFrameQueueDepth)
+    {
+        statistics.maxFrameQueueDepth = depth;
+    }
+}
+
+// Publishes a quality step taken by the policy; the discard flags are up to the caller
+void VideoParseRunnable::setDegradation(DecodingDegradation level)
+{
+    const int previous = m_ffmpeg->m_degradationLevel.exchange(level);
+    CHANNEL_LOG(ffmpeg_sync) << "Degradation level " << previous << " -> " << level;
+
+    PipelineStatistics& statistics = m_ffmpeg->m_statistics;
+    statistics.degradationLevel = level;
+    if (level > previous)
+    {
+        ++statistics.degradations[level];
+    }
+
+    if (m_ffmpeg->m_decoderListener)
+    {
+        m_ffmpeg->m_decoderListener->decodingDegraded(level);
+    }
+}
+
 void VideoParseRunnable::operator()()
 {
     CHANNEL_LOG(ffmpeg_threads) << "Video thread started";
+    TraceRecorder::instance().setThreadName("video");
     m_ffmpeg->m_videoStartClock = GetHiResTime();
     double videoClock = 0; // pts of last decoded frame / predicted pts of next decoded frame
 
     bool initialized = false;
 
+    unsigned generation = m_ffmpeg->m_videoPacketsQueue.generation();
+    int64_t seekTarget = AV_NOPTS_VALUE;  // frames before it get decoded but not shown
+    double seekRequestTime = 0;           // pending seek latency sample
+    bool scrubbing = false;               // showing a single keyframe per seek
+    bool draining = false;                // getting the held back frames out at the end
+    AVDiscard discard = AVDISCARD_DEFAULT;
+    DegradationPolicy degradation(GetHiResTime());
+    DecodingDegradation level = DEGRADATION_NONE;
+    DecodingDegradation appliedLevel = DEGRADATION_NONE;  // discard flags set for it
+
+    // Presentation queue sizing
+    const AVRational frameRate = m_ffmpeg->m_videoStream->avg_frame_rate;
+    const double frameInterval =
+        (frameRate.num > 0 && frameRate.den > 0) ? 1. / av_q2d(frameRate) : DEFAULT_FRAME_INTERVAL;
+    DecodeTimeSpread decodeTimes;
+    double frameDecodeTime = 0;  // decoding since the last frame came out
+    double lastShrinkTime = GetHiResTime();
+
     for (;;)
     {
         if (m_ffmpeg->m_isPaused && !m_ffmpeg->m_isVideoSeekingWhilePaused)
         {
             boost::unique_lock<boost::mutex> locker(m_ffmpeg->m_isPausedMutex);
-            while (m_ffmpeg->m_isPaused)
+            while (m_ffmpeg->m_isPaused && !m_ffmpeg->m_isVideoSeekingWhilePaused)
             {
                 m_ffmpeg->m_isPausedCV.wait(locker);
             }
+            degradation.restart(GetHiResTime());
             continue;
         }
 
         for (;;)
         {
+            if (draining && m_ffmpeg->m_videoPacketsQueue.generation() != generation)
+            {
+                draining = false;  // a seek; the flush below throws the rest away
+            }
+
             AVPacket packet;
-            if (!getVideoPacket(&packet))
+            unsigned packetGeneration;
+            if (draining)
+            {
+                av_init_packet(&packet);
+                packet.data = nullptr;
+                packet.size = 0;
+                packetGeneration = generation;
+            }
+            else if (!getVideoPacket(&packet, &packetGeneration))
             {
                 break;
             }
+            const bool endOfStream = packet.data == nullptr && packet.size == 0;
+
+            if (packetGeneration != generation)
+            {
+                // First packet after a seek
+                generation = packetGeneration;
+                avcodec_flush_buffers(m_ffmpeg->m_videoCodecContext);
+                initialized = false;
+                videoClock = 0;
+                frameDecodeTime = 0;
+                seekTarget = m_ffmpeg->m_seekTarget;
+                scrubbing = m_ffmpeg->m_scrubSeek;
+                seekRequestTime = m_ffmpeg->m_seekRequestTime;
+                degradation.restart(GetHiResTime());
+
+                // Frames still queued belong to the old position: hurry them out
+                boost::lock_guard<boost::mutex> locker(m_ffmpeg->m_videoFramesMutex);
+                m_ffmpeg->m_videoFramesQueue.setDisplayTime(GetHiResTime());
+            }
+
+            const bool beforeTarget = seekTarget != AV_NOPTS_VALUE &&
+                                      packet.pts != AV_NOPTS_VALUE && packet.pts < seekTarget;
+            const AVDiscard packetDiscard = scrubbing ? AVDISCARD_NONKEY
+                                          : beforeTarget ? AVDISCARD_NONREF
+                                          : AVDISCARD_DEFAULT;
+            // Decoding more than keyframes again waits for the next one, as the frames
+            // up to it refer to pictures that were skipped
+            const bool levelApplicable = level != appliedLevel &&
+                                         (level > appliedLevel ||
+                                          appliedLevel < DEGRADATION_KEYFRAMES_ONLY ||
+                                          (packet.flags & AV_PKT_FLAG_KEY));
+            if (packetDiscard != discard || levelApplicable)
+            {
+                discard = packetDiscard;
+                if (levelApplicable)
+                {
+                    appliedLevel = level;
+                }
+                setDiscard(m_ffmpeg->m_videoCodecContext, discard, appliedLevel);
+            }
 
             int frameFinished = 0;
 
+            const double decodeStart = GetHiResTime();
+            av_frame_unref(m_ffmpeg->m_videoFrame);  // the conversion stage holds its own ref
             auto res = avcodec_decode_video2(m_ffmpeg->m_videoCodecContext, m_ffmpeg->m_videoFrame,
                                              &frameFinished, &packet);
+            if (scrubbing)
+            {
+                // No packet follows a scrub keyframe: drain the decoder's delay to get its
+                // picture out. The next seek flushes the decoder anyway.
+                AVPacket drainPacket;
+                av_init_packet(&drainPacket);
+                drainPacket.data = nullptr;
+                drainPacket.size = 0;
+                for (int i = 0; !frameFinished && i < MAX_DRAIN_CALLS; ++i)
+                {
+                    avcodec_decode_video2(m_ffmpeg->m_videoCodecContext, m_ffmpeg->m_videoFrame,
+                                          &frameFinished, &drainPacket);
+                }
+            }
+            if (endOfStream)
+            {
+                // Once drained, the decoder takes packets again only after a flush
+                draining = frameFinished != 0;
+                if (!draining)
+                {
+                    avcodec_flush_buffers(m_ffmpeg->m_videoCodecContext);
+                    int drainGeneration = int(generation);
+                    m_ffmpeg->m_videoDrainGeneration.compare_exchange_strong(drainGeneration, -1);
+                }
+            }
+            const double decodeEnd = GetHiResTime();
+            frameDecodeTime += decodeEnd - decodeStart;
+            if (m_ffmpeg->m_adaptiveQuality)
+            {
+                degradation.addDecodeTime(decodeEnd - decodeStart);
+                const DecodingDegradation newLevel = degradation.update(decodeEnd);
+                if (newLevel != level)
+                {
+                    level = newLevel;  // applied from the next packet on
+                    setDegradation(level);
+                }
+            }
+            m_ffmpeg->m_statistics.videoDecode.add(decodeEnd - decodeStart);
+            TraceRecorder::instance().addSpan("decode video", decodeStart, decodeEnd);
             av_free_packet(&packet);
 
             if (frameFinished)
             {
+                ++m_ffmpeg->m_statistics.decodedFrames;
+
                 const int64_t duration_stamp =
                     av_frame_get_best_effort_timestamp(m_ffmpeg->m_videoFrame);
 
+                if (seekTarget != AV_NOPTS_VALUE)
+                {
+                    if (duration_stamp != AV_NOPTS_VALUE && duration_stamp < seekTarget)
+                    {
+                        frameDecodeTime = 0;
+                        continue;  // not there yet; no need to convert it
+                    }
+                    seekTarget = AV_NOPTS_VALUE;
+                }
+
+                if (m_ffmpeg->m_adaptiveFrameQueue && !scrubbing)
+                {
+                    decodeTimes.add(frameDecodeTime);
+                    adaptFrameQueueDepth(decodeTimes.queueDepth(frameInterval), &lastShrinkTime);
+                }
+                frameDecodeTime = 0;
+
                 if (!initialized)
                 {
                     const double stamp =
@@ -107,6 +447,8 @@ void VideoParseRunnable::operator()()
                         }
 
                         CHANNEL_LOG(ffmpeg_sync) << "Hard skip frame";
+                        ++m_ffmpeg->m_statistics.hardSkippedFrames;
+                        degradation.addLateFrame();
 
                         // pause
                         if (m_ffmpeg->m_isPaused && !m_ffmpeg->m_isVideoSeekingWhilePaused)
@@ -124,27 +466,36 @@ void VideoParseRunnable::operator()()
                 initialized = true;
 
                 {
+                    const double waitStart = GetHiResTime();
                     boost::unique_lock<boost::mutex> locker(m_ffmpeg->m_videoFramesMutex);
 
-                    auto cond = [this]()
+                    auto cond = [this, generation]()
                     {
                         return m_ffmpeg->m_isPaused && !m_ffmpeg->m_isVideoSeekingWhilePaused ||
-                               m_ffmpeg->m_videoFramesQueue.m_busy < VIDEO_PICTURE_QUEUE_SIZE;
+                               m_ffmpeg->m_videoFramesQueue.m_busy +
+                                       m_ffmpeg->m_videoFramesQueue.m_converting <
+                                   m_ffmpeg->m_videoFramesQueue.m_depth ||
+                               m_ffmpeg->m_videoPacketsQueue.generation() != generation;
                     };
 
+                    bool isSlotFree = true;
                     if (td.is_pos_infinity())
                     {
                         m_ffmpeg->m_videoFramesCV.wait(locker, cond);
                     }
-                    else if (!m_ffmpeg->m_videoFramesCV.timed_wait(locker, td, cond))
+                    else
                     {
-                        continue;
+                        isSlotFree = m_ffmpeg->m_videoFramesCV.timed_wait(locker, td, cond);
                     }
 
-                    assert(m_ffmpeg->m_isPaused && !m_ffmpeg->m_isVideoSeekingWhilePaused ||
-                           !(m_ffmpeg->m_videoFramesQueue.m_write_counter ==
-                                 m_ffmpeg->m_videoFramesQueue.m_read_counter &&
-                             m_ffmpeg->m_videoFramesQueue.m_busy > 0));
+                    const double waitEnd = GetHiResTime();
+                    m_ffmpeg->m_statistics.videoFrameQueueWait.add(waitEnd - waitStart);
+                    TraceRecorder::instance().addSpan("frame queue wait", waitStart, waitEnd);
+                    if (!isSlotFree ||
+                        m_ffmpeg->m_videoPacketsQueue.generation() != generation)
+                    {
+                        continue;  // too late, or the frame predates a seek
+                    }
                 }
 
                 if (m_ffmpeg->m_isPaused && !m_ffmpeg->m_isVideoSeekingWhilePaused)
@@ -154,25 +505,26 @@ void VideoParseRunnable::operator()()
 
                 m_ffmpeg->m_isVideoSeekingWhilePaused = false;
 
-                int wrcount = m_ffmpeg->m_videoFramesQueue.m_write_counter;
-                VideoFrame* current_frame = &m_ffmpeg->m_videoFramesQueue.m_frames[wrcount];
-                if (!m_ffmpeg->frameToImage(current_frame->m_image))
+                // Hand the frame over by reference and go on decoding while it converts
+                FFmpegDecoder::ConversionJob job;
+                job.frame = av_frame_clone(m_ffmpeg->m_videoFrame);
+                if (job.frame == nullptr)
                 {
                     continue;
                 }
-
-                current_frame->m_displayTime = m_ffmpeg->m_videoStartClock + pts;
-                current_frame->m_duration = duration_stamp;
-
-                m_ffmpeg->m_videoFramesQueue.m_write_counter =
-                    (m_ffmpeg->m_videoFramesQueue.m_write_counter + 1) %
-                    (sizeof(m_ffmpeg->m_videoFramesQueue.m_frames) /
-                    sizeof(m_ffmpeg->m_videoFramesQueue.m_frames[0]));
+                job.displayTime = m_ffmpeg->m_videoStartClock + pts;
+                job.duration = duration_stamp;
+                job.generation = generation;
+                job.seekRequestTime = seekRequestTime;
+                seekRequestTime = 0;
 
                 {
                     boost::lock_guard<boost::mutex> locker(m_ffmpeg->m_videoFramesMutex);
-                    ++m_ffmpeg->m_videoFramesQueue.m_busy;
-                    assert(m_ffmpeg->m_videoFramesQueue.m_busy <= VIDEO_PICTURE_QUEUE_SIZE);
+                    ++m_ffmpeg->m_videoFramesQueue.m_converting;
+                    assert(m_ffmpeg->m_videoFramesQueue.m_busy +
+                               m_ffmpeg->m_videoFramesQueue.m_converting <=
+                           m_ffmpeg->m_videoFramesQueue.m_depth);
+                    m_ffmpeg->m_conversionJobs.push_back(job);
                 }
                 m_ffmpeg->m_videoFramesCV.notify_all();
             }
@@ -6,7 +6,9 @@ class VideoParseRunnable
 {
 	FFmpegDecoder* m_ffmpeg;
 
-    bool getVideoPacket(AVPacket* packet);
+    bool getVideoPacket(AVPacket* packet, unsigned* generation);
+    void adaptFrameQueueDepth(int depth, double* lastShrinkTime);
+    void setDegradation(DecodingDegradation level);
 
 public:
 	explicit VideoParseRunnable(FFmpegDecoder* parent)
@@ -1,16 +1,27 @@
 #pragma once
 
-// Video frame struct for RGB24 frame (used by displays)
+// Ring of converted frames waiting for display. It has room for the deepest queue, while
+// m_depth limits how many frames are queued or in conversion at a time. Pictures of the
+// frames displayed are kept as spares for the slots written next, so about m_depth of
+// them stay allocated wherever the ring is.
 struct VQueue
 {
-    VideoFrame m_frames[VIDEO_PICTURE_QUEUE_SIZE];
+    VideoFrame m_frames[MAX_VIDEO_PICTURE_QUEUE_SIZE];
     int m_write_counter;
     int m_read_counter;
     int m_busy;
+    int m_converting;  // slots reserved for frames in the conversion stage
+    int m_depth;       // limit on m_busy + m_converting
+
+    FPicture m_spares[MAX_VIDEO_PICTURE_QUEUE_SIZE];
+    int m_spareCount;
 
     VQueue() : m_write_counter(0),
                m_read_counter(0),
-               m_busy(0)
+               m_busy(0),
+               m_converting(0),
+               m_depth(MIN_VIDEO_PICTURE_QUEUE_SIZE),
+               m_spareCount(0)
     {
     }
 
@@ -18,13 +29,19 @@ struct VQueue
     {
         for (auto& frame : m_frames)
         {
-            frame.m_image.free();
+            frame.free();
+        }
+        for (auto& spare : m_spares)
+        {
+            spare.free();
         }
+        m_spareCount = 0;
 
         // Reset readers
         m_write_counter = 0;
         m_read_counter = 0;
         m_busy = 0;
+        m_converting = 0;
     }
 
     void setDisplayTime(double displayTime)
@@ -34,4 +51,40 @@ struct VQueue
             frame.m_displayTime = displayTime;
         }
     }
+
+    void setDepth(int depth)
+    {
+        m_depth = depth;
+        while (m_spareCount > 0 && m_spareCount + m_busy + m_converting > m_depth)
+        {
+            m_spares[--m_spareCount].free();
+        }
+    }
+
+    // Takes back the picture of a frame done with; the decoder's buffers go right away.
+    void recycle(VideoFrame& frame)
+    {
+        av_frame_free(&frame.m_source);
+        if (frame.m_image.data[0] == nullptr)
+        {
+            return;
+        }
+        if (m_spareCount + m_busy + m_converting < m_depth)
+        {
+            m_spares[m_spareCount++].swap(frame.m_image);
+        }
+        else
+        {
+            frame.m_image.free();
+        }
+    }
+
+    // Gives a slot about to be written a spare picture, if it has none
+    void reuseSpare(VideoFrame& frame)
+    {
+        if (frame.m_image.data[0] == nullptr && m_spareCount > 0)
+        {
+            frame.m_image.swap(m_spares[--m_spareCount]);
+        }
+    }
 };
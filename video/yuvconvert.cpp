@@ -0,0 +1,444 @@
+#include "yuvconvert.h"
+
+#include <algorithm>
+#include <stddef.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define YUV_X86 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// MSVC emits any intrinsic anywhere; GCC and Clang want the functions using them marked
+#if defined(YUV_X86) && !defined(_MSC_VER)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+// RGB arithmetic is 16 bit fixed point, done alike by every kernel so their output is
+// identical: samples minus their offset are scaled by 64, multiplied by Q13 coefficients
+// keeping the high 16 bits (a Q3 result, as _mm_mulhi_epi16 does), summed and rounded.
+
+namespace
+{
+
+struct RgbCoefficients
+{
+    int16_t yOffset;
+    int16_t yScale;
+    int16_t rv;
+    int16_t gu;
+    int16_t gv;
+    int16_t bu;
+};
+
+RgbCoefficients rgbCoefficients(const AVFrame* frame)
+{
+    const bool bt709 = frame->colorspace == AVCOL_SPC_BT709;
+    const double kr = bt709 ? 0.2126 : 0.299;
+    const double kb = bt709 ? 0.0722 : 0.114;
+    const double kg = 1. - kr - kb;
+
+    const bool fullRange =
+        frame->format == AV_PIX_FMT_YUVJ420P || frame->color_range == AVCOL_RANGE_JPEG;
+    const double yScale = fullRange ? 1. : 255. / 219.;
+    const double cScale = fullRange ? 1. : 255. / 224.;
+
+    const double one = 1 << 13;
+    RgbCoefficients c;
+    c.yOffset = fullRange ? 0 : 16;
+    c.yScale = int16_t(yScale * one + 0.5);
+    c.rv = int16_t(2. * (1. - kr) * cScale * one + 0.5);
+    c.gu = int16_t(-2. * kb * (1. - kb) / kg * cScale * one - 0.5);
+    c.gv = int16_t(-2. * kr * (1. - kr) / kg * cScale * one - 0.5);
+    c.bu = int16_t(2. * (1. - kb) * cScale * one + 0.5);
+    return c;
+}
+
+inline int mulhi(int a, int b) { return (a * b) >> 16; }
+
+inline uint8_t clampToByte(int value)
+{
+    return uint8_t(std::min(std::max(value, 0), 255));
+}
+
+// Each row kernel converts from pixel x on and returns where it stopped; the plain C
+// ones finish the row after the vectorized ones.
+
+typedef int (*YuyvRow)(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst,
+                       int x, int width);
+typedef int (*RgbRow)(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst,
+                      int x, int width, const RgbCoefficients& c);
+
+int yuyvRowC(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int x,
+             int width)
+{
+    for (; x + 1 < width; x += 2)
+    {
+        dst[2 * x] = y[x];
+        dst[2 * x + 1] = u[x / 2];
+        dst[2 * x + 2] = y[x + 1];
+        dst[2 * x + 3] = v[x / 2];
+    }
+    if (x < width)
+    {
+        dst[2 * x] = y[x];
+        dst[2 * x + 1] = u[x / 2];
+        ++x;
+    }
+    return x;
+}
+
+int rgbRowC(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* dst, int x,
+            int width, const RgbCoefficients& c)
+{
+    for (; x < width; ++x)
+    {
+        const int yy = mulhi((y[x] - c.yOffset) * 64, c.yScale) + 4;
+        const int uu = (u[x / 2] - 128) * 64;
+        const int vv = (v[x / 2] - 128) * 64;
+        dst[3 * x] = clampToByte((yy + mulhi(vv, c.rv)) >> 3);
+        dst[3 * x + 1] = clampToByte((yy + mulhi(uu, c.gu) + mulhi(vv, c.gv)) >> 3);
+        dst[3 * x + 2] = clampToByte((yy + mulhi(uu, c.bu)) >> 3);
+    }
+    return x;
+}
+
+#ifdef YUV_X86
+
+TARGET_SSE2 int yuyvRowSse2(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                            uint8_t* dst, int x, int width)
+{
+    for (; x + 32 <= width; x += 32)
+    {
+        const __m128i uu = _mm_loadu_si128((const __m128i*)(u + x / 2));
+        const __m128i vv = _mm_loadu_si128((const __m128i*)(v + x / 2));
+        const __m128i uvLo = _mm_unpacklo_epi8(uu, vv);
+        const __m128i uvHi = _mm_unpackhi_epi8(uu, vv);
+        const __m128i y0 = _mm_loadu_si128((const __m128i*)(y + x));
+        const __m128i y1 = _mm_loadu_si128((const __m128i*)(y + x + 16));
+
+        __m128i* out = (__m128i*)(dst + 2 * x);
+        _mm_storeu_si128(out, _mm_unpacklo_epi8(y0, uvLo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(y0, uvLo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi8(y1, uvHi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi8(y1, uvHi));
+    }
+    return x;
+}
+
+// Writes 16 pixels as 48 bytes, and 2 bytes of garbage after them
+TARGET_SSE2 void storeRgbSse2(uint8_t* dst, __m128i r, __m128i g, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i low24 = _mm_set_epi32(0, 0x00FFFFFF, 0, 0x00FFFFFF);
+    const __m128i rgLo = _mm_unpacklo_epi8(r, g);
+    const __m128i rgHi = _mm_unpackhi_epi8(r, g);
+    const __m128i bLo = _mm_unpacklo_epi8(b, zero);
+    const __m128i bHi = _mm_unpackhi_epi8(b, zero);
+    const __m128i rgbx[4] = {_mm_unpacklo_epi16(rgLo, bLo), _mm_unpackhi_epi16(rgLo, bLo),
+                             _mm_unpacklo_epi16(rgHi, bHi), _mm_unpackhi_epi16(rgHi, bHi)};
+
+    // Without byte shuffles: close the gap in each pair of pixels, then let the stores
+    // of the next pair overwrite the two bytes left over
+    for (int i = 0; i < 4; ++i)
+    {
+        const __m128i packed = _mm_or_si128(_mm_and_si128(rgbx[i], low24),
+                                            _mm_slli_epi64(_mm_srli_epi64(rgbx[i], 32), 24));
+        _mm_storel_epi64((__m128i*)dst, packed);
+        _mm_storel_epi64((__m128i*)(dst + 6), _mm_srli_si128(packed, 8));
+        dst += 12;
+    }
+}
+
+TARGET_SSE2 int rgbRowSse2(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                           uint8_t* dst, int x, int width, const RgbCoefficients& c)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i yOffset = _mm_set1_epi16(c.yOffset);
+    const __m128i yScale = _mm_set1_epi16(c.yScale);
+    const __m128i rv = _mm_set1_epi16(c.rv);
+    const __m128i gu = _mm_set1_epi16(c.gu);
+    const __m128i gv = _mm_set1_epi16(c.gv);
+    const __m128i bu = _mm_set1_epi16(c.bu);
+    const __m128i chromaOffset = _mm_set1_epi16(128);
+    const __m128i rounding = _mm_set1_epi16(4);
+
+    // A pixel to spare after each block for the stores running over
+    for (; x + 16 < width; x += 16)
+    {
+        __m128i uu = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(u + x / 2)), zero);
+        __m128i vv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(v + x / 2)), zero);
+        uu = _mm_slli_epi16(_mm_sub_epi16(uu, chromaOffset), 6);
+        vv = _mm_slli_epi16(_mm_sub_epi16(vv, chromaOffset), 6);
+        const __m128i r = _mm_mulhi_epi16(vv, rv);
+        const __m128i g = _mm_add_epi16(_mm_mulhi_epi16(uu, gu), _mm_mulhi_epi16(vv, gv));
+        const __m128i b = _mm_mulhi_epi16(uu, bu);
+
+        const __m128i yy = _mm_loadu_si128((const __m128i*)(y + x));
+        __m128i y0 = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(yy, zero), yOffset), 6);
+        __m128i y1 = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(yy, zero), yOffset), 6);
+        y0 = _mm_add_epi16(_mm_mulhi_epi16(y0, yScale), rounding);
+        y1 = _mm_add_epi16(_mm_mulhi_epi16(y1, yScale), rounding);
+
+        // Each chroma sample serves two pixels
+        const __m128i red = _mm_packus_epi16(
+            _mm_srai_epi16(_mm_add_epi16(y0, _mm_unpacklo_epi16(r, r)), 3),
+            _mm_srai_epi16(_mm_add_epi16(y1, _mm_unpackhi_epi16(r, r)), 3));
+        const __m128i green = _mm_packus_epi16(
+            _mm_srai_epi16(_mm_add_epi16(y0, _mm_unpacklo_epi16(g, g)), 3),
+            _mm_srai_epi16(_mm_add_epi16(y1, _mm_unpackhi_epi16(g, g)), 3));
+        const __m128i blue = _mm_packus_epi16(
+            _mm_srai_epi16(_mm_add_epi16(y0, _mm_unpacklo_epi16(b, b)), 3),
+            _mm_srai_epi16(_mm_add_epi16(y1, _mm_unpackhi_epi16(b, b)), 3));
+
+        storeRgbSse2(dst + 3 * x, red, green, blue);
+    }
+    return x;
+}
+
+TARGET_AVX2 int yuyvRowAvx2(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                            uint8_t* dst, int x, int width)
+{
+    for (; x + 32 <= width; x += 32)
+    {
+        const __m256i uu = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(u + x / 2)));
+        const __m256i vv = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(v + x / 2)));
+        const __m256i uv = _mm256_or_si256(uu, _mm256_slli_epi16(vv, 8));
+        const __m256i yy = _mm256_loadu_si256((const __m256i*)(y + x));
+
+        // Unpacking works within 128 bit lanes: pixels 0-7 and 16-23, then 8-15 and 24-31
+        const __m256i lo = _mm256_unpacklo_epi8(yy, uv);
+        const __m256i hi = _mm256_unpackhi_epi8(yy, uv);
+
+        __m256i* out = (__m256i*)(dst + 2 * x);
+        _mm256_storeu_si256(out, _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    return x;
+}
+
+// Writes 16 pixels as 48 bytes, and 4 bytes of garbage after them
+TARGET_AVX2 void storeRgbAvx2(uint8_t* dst, __m128i r, __m128i g, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i compact = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m128i rgLo = _mm_unpacklo_epi8(r, g);
+    const __m128i rgHi = _mm_unpackhi_epi8(r, g);
+    const __m128i bLo = _mm_unpacklo_epi8(b, zero);
+    const __m128i bHi = _mm_unpackhi_epi8(b, zero);
+    const __m128i rgbx[4] = {_mm_unpacklo_epi16(rgLo, bLo), _mm_unpackhi_epi16(rgLo, bLo),
+                             _mm_unpacklo_epi16(rgHi, bHi), _mm_unpackhi_epi16(rgHi, bHi)};
+    for (int i = 0; i < 4; ++i)
+    {
+        _mm_storeu_si128((__m128i*)dst, _mm_shuffle_epi8(rgbx[i], compact));
+        dst += 12;
+    }
+}
+
+TARGET_AVX2 int rgbRowAvx2(const uint8_t* y, const uint8_t* u, const uint8_t* v,
+                           uint8_t* dst, int x, int width, const RgbCoefficients& c)
+{
+    const __m256i yOffset = _mm256_set1_epi16(c.yOffset);
+    const __m256i yScale = _mm256_set1_epi16(c.yScale);
+    const __m256i rv = _mm256_set1_epi16(c.rv);
+    const __m256i gu = _mm256_set1_epi16(c.gu);
+    const __m256i gv = _mm256_set1_epi16(c.gv);
+    const __m256i bu = _mm256_set1_epi16(c.bu);
+    const __m256i chromaOffset = _mm256_set1_epi16(128);
+    const __m256i rounding = _mm256_set1_epi16(4);
+
+    // Two pixels to spare after each block for the stores running over
+    for (; x + 34 <= width; x += 32)
+    {
+        __m256i uu = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(u + x / 2)));
+        __m256i vv = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(v + x / 2)));
+        uu = _mm256_slli_epi16(_mm256_sub_epi16(uu, chromaOffset), 6);
+        vv = _mm256_slli_epi16(_mm256_sub_epi16(vv, chromaOffset), 6);
+        const __m256i r = _mm256_mulhi_epi16(vv, rv);
+        const __m256i g =
+            _mm256_add_epi16(_mm256_mulhi_epi16(uu, gu), _mm256_mulhi_epi16(vv, gv));
+        const __m256i b = _mm256_mulhi_epi16(uu, bu);
+
+        const __m256i yy = _mm256_loadu_si256((const __m256i*)(y + x));
+        __m256i y0 = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(yy));
+        __m256i y1 = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(yy, 1));
+        y0 = _mm256_slli_epi16(_mm256_sub_epi16(y0, yOffset), 6);
+        y1 = _mm256_slli_epi16(_mm256_sub_epi16(y1, yOffset), 6);
+        y0 = _mm256_add_epi16(_mm256_mulhi_epi16(y0, yScale), rounding);
+        y1 = _mm256_add_epi16(_mm256_mulhi_epi16(y1, yScale), rounding);
+
+        // Doubling chroma within lanes yields pixels 0-7 and 16-23, then 8-15 and 24-31;
+        // packing does the same again, undone by the final permutation
+        __m256i channels[3];
+        const __m256i chroma[3] = {r, g, b};
+        for (int i = 0; i < 3; ++i)
+        {
+            const __m256i lo = _mm256_unpacklo_epi16(chroma[i], chroma[i]);
+            const __m256i hi = _mm256_unpackhi_epi16(chroma[i], chroma[i]);
+            const __m256i first = _mm256_srai_epi16(
+                _mm256_add_epi16(y0, _mm256_permute2x128_si256(lo, hi, 0x20)), 3);
+            const __m256i second = _mm256_srai_epi16(
+                _mm256_add_epi16(y1, _mm256_permute2x128_si256(lo, hi, 0x31)), 3);
+            channels[i] = _mm256_permute4x64_epi64(_mm256_packus_epi16(first, second), 0xD8);
+        }
+
+        storeRgbAvx2(dst + 3 * x, _mm256_castsi256_si128(channels[0]),
+                     _mm256_castsi256_si128(channels[1]), _mm256_castsi256_si128(channels[2]));
+        storeRgbAvx2(dst + 3 * x + 48, _mm256_extracti128_si256(channels[0], 1),
+                     _mm256_extracti128_si256(channels[1], 1),
+                     _mm256_extracti128_si256(channels[2], 1));
+    }
+    return x;
+}
+
+YuvInstructionSet detectInstructionSet()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+    __cpuid(info, 1);
+    if (!(info[3] & (1 << 26)))
+    {
+        return YUV_ISA_C;
+    }
+    // AVX state has to be enabled by the OS too
+    const bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+    if (osAvx && maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5))
+        {
+            return YUV_ISA_AVX2;
+        }
+    }
+    return YUV_ISA_SSE2;
+#else
+    // Detection runs before main, ahead of the runtime's own initialization
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2")   ? YUV_ISA_AVX2
+           : __builtin_cpu_supports("sse2") ? YUV_ISA_SSE2
+                                            : YUV_ISA_C;
+#endif
+}
+
+#else
+
+YuvInstructionSet detectInstructionSet() { return YUV_ISA_C; }
+
+#endif  // YUV_X86
+
+const YuvInstructionSet s_supported = detectInstructionSet();
+
+// Vectorized row kernels of a set, null for C only
+YuyvRow yuyvRowFor(YuvInstructionSet isa)
+{
+#ifdef YUV_X86
+    if (isa == YUV_ISA_AVX2)
+    {
+        return yuyvRowAvx2;
+    }
+    if (isa == YUV_ISA_SSE2)
+    {
+        return yuyvRowSse2;
+    }
+#endif
+    return nullptr;
+}
+
+RgbRow rgbRowFor(YuvInstructionSet isa)
+{
+#ifdef YUV_X86
+    if (isa == YUV_ISA_AVX2)
+    {
+        return rgbRowAvx2;
+    }
+    if (isa == YUV_ISA_SSE2)
+    {
+        return rgbRowSse2;
+    }
+#endif
+    return nullptr;
+}
+
+YuvInstructionSet s_active = s_supported;
+YuyvRow s_yuyvRow = yuyvRowFor(s_supported);
+RgbRow s_rgbRow = rgbRowFor(s_supported);
+
+}  // namespace
+
+bool canConvertYuv(const AVFrame* frame, AVPixelFormat format)
+{
+    if (frame->format != AV_PIX_FMT_YUV420P && frame->format != AV_PIX_FMT_YUVJ420P)
+    {
+        return false;
+    }
+    // YUYV output takes the samples as they are, so only limited range ones fit
+    return format == AV_PIX_FMT_RGB24 ||
+           (format == AV_PIX_FMT_YUYV422 && frame->format == AV_PIX_FMT_YUV420P &&
+            frame->color_range != AVCOL_RANGE_JPEG);
+}
+
+void convertYuvRows(const AVFrame* frame, AVPixelFormat format, int firstRow, int rows,
+                    uint8_t* const dst[], const int dstLinesize[])
+{
+    const bool rgb = format == AV_PIX_FMT_RGB24;
+    const RgbCoefficients coefficients = rgb ? rgbCoefficients(frame) : RgbCoefficients();
+    const int width = frame->width;
+
+    for (int row = firstRow; row < firstRow + rows; ++row)
+    {
+        const uint8_t* y = frame->data[0] + ptrdiff_t(frame->linesize[0]) * row;
+        const uint8_t* u = frame->data[1] + ptrdiff_t(frame->linesize[1]) * (row >> 1);
+        const uint8_t* v = frame->data[2] + ptrdiff_t(frame->linesize[2]) * (row >> 1);
+        uint8_t* out = dst[0] + ptrdiff_t(dstLinesize[0]) * row;
+
+        int x = 0;
+        if (rgb)
+        {
+            if (s_rgbRow)
+            {
+                x = s_rgbRow(y, u, v, out, x, width, coefficients);
+            }
+            rgbRowC(y, u, v, out, x, width, coefficients);
+        }
+        else
+        {
+            if (s_yuyvRow)
+            {
+                x = s_yuyvRow(y, u, v, out, x, width);
+            }
+            yuyvRowC(y, u, v, out, x, width);
+        }
+    }
+}
+
+YuvInstructionSet supportedYuvInstructionSet() { return s_supported; }
+
+void setYuvInstructionSet(YuvInstructionSet isa)
+{
+    s_active = std::min(isa, s_supported);
+    s_yuyvRow = yuyvRowFor(s_active);
+    s_rgbRow = rgbRowFor(s_active);
+}
+
+YuvInstructionSet yuvInstructionSet() { return s_active; }
+
+const char* yuvInstructionSetName(YuvInstructionSet isa)
+{
+    switch (isa)
+    {
+    case YUV_ISA_AVX2:
+        return "avx2";
+    case YUV_ISA_SSE2:
+        return "sse2";
+    default:
+        return "c";
+    }
+}
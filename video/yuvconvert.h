@@ -0,0 +1,31 @@
+#pragma once
+
+extern "C" {
+#include <libavutil/frame.h>
+}
+
+// Same-size conversions from planar YUV 4:2:0 to the packed formats the views take,
+// vectorized by hand for the instruction sets found at run time; frames in any other
+// layout are left to swscale. RGB follows the frame's BT.601 or BT.709 matrix and range.
+
+enum YuvInstructionSet
+{
+    YUV_ISA_C,
+    YUV_ISA_SSE2,
+    YUV_ISA_AVX2,
+};
+
+// Whether convertYuvRows() takes this frame to format.
+bool canConvertYuv(const AVFrame* frame, AVPixelFormat format);
+
+// Converts rows [firstRow, firstRow + rows) of frame into the same rows of dst.
+void convertYuvRows(const AVFrame* frame, AVPixelFormat format, int firstRow, int rows,
+                    uint8_t* const dst[], const int dstLinesize[]);
+
+// The best the processor has; every set gives the same output.
+YuvInstructionSet supportedYuvInstructionSet();
+// For comparisons: limits the kernels to isa, or to the supported set if that's lower.
+// Not to be changed while conversions run.
+void setYuvInstructionSet(YuvInstructionSet isa);
+YuvInstructionSet yuvInstructionSet();
+const char* yuvInstructionSetName(YuvInstructionSet isa);